@@ -0,0 +1,214 @@
+/******************************************************************************
+ *
+ *  Compact encoding of several disk metrics into one ganglia string value.
+ *
+ *  A packed value is the version character 'A' followed by the base64url
+ *  encoding (RFC 4648 alphabet A-Z a-z 0-9 - _, without padding) of up to
+ *  PACKED_MAX_VALUES 32 bit words in network byte order.  Every word holds
+ *  one metric of one of the types
+ *
+ *     'u'  unsigned 32 bit integer, used for counts and depths
+ *     'm'  unsigned 32 bit number of MB (2^20 bytes), used for disk sizes
+ *          which would lose precision as float
+ *     'f'  IEEE 754 single precision float
+ *
+ *  The module reports unknown values as -1.  For 'u' and 'm' that is the
+ *  word PACKED_UNKNOWN (0xFFFFFFFF), so it stays distinct from 0, and the
+ *  largest value is one below it.
+ *
+ *  The layout of a packed value is published in the metric description
+ *  after the last ": " as a comma separated list of <name>:<type>, e.g.
+ *
+ *     packed metrics: xfers:f,rbytes:f,wbytes:f,q_full:u
+ *
+ *  With MAX_G_STRING_SIZE = 64 this leaves room for 11 values per disk.
+ *
+ *  Decoders define PACKED_DECODER before including this file to get the
+ *  decoding instead of the encoding functions.
+ *
+ ******************************************************************************/
+
+#ifndef AIXDISK_PACKED_H
+#define AIXDISK_PACKED_H
+
+#include <string.h>
+
+
+#define PACKED_VERSION 'A'
+
+#define PACKED_MAX_VALUES 11
+
+#define PACKED_UNKNOWN 4294967295U
+
+#define PACKED_MB 1048576.0
+
+
+static const char packed_alphabet[] =
+   "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+
+
+#ifndef PACKED_DECODER
+
+/* store a value of the given type in a 32 bit word */
+static unsigned int
+packed_word( char type, double value )
+{
+   union {
+      float f;
+      unsigned int u;
+   } w;
+
+
+   if ((type == 'u') || (type == 'm'))
+   {
+      if (value < 0.0)
+         return( PACKED_UNKNOWN );
+
+      if (type == 'm')
+         value /= PACKED_MB;
+
+      if (value >= 4294967294.0)
+         return( PACKED_UNKNOWN - 1 );
+
+      return( (unsigned int) (value + 0.5) );
+   }
+
+   w.f = (float) value;
+
+   return( w.u );
+}
+
+
+
+/* Encode n words into buf, which must hold at least
+   2 + (4 * n * 4 + 2) / 3 characters.  Returns the string length. */
+static int
+packed_encode( char *buf, const unsigned int *words, int n )
+{
+   unsigned char bytes[4 * PACKED_MAX_VALUES];
+   unsigned int bits;
+   int nbytes,
+       i,
+       len;
+
+
+   if (n > PACKED_MAX_VALUES)
+      n = PACKED_MAX_VALUES;
+
+   for (i = 0;  i < n;  i++)
+   {
+      bytes[4 * i]     = (unsigned char) (words[i] >> 24);
+      bytes[4 * i + 1] = (unsigned char) (words[i] >> 16);
+      bytes[4 * i + 2] = (unsigned char) (words[i] >> 8);
+      bytes[4 * i + 3] = (unsigned char) words[i];
+   }
+   nbytes = 4 * n;
+
+   len = 0;
+   buf[len++] = PACKED_VERSION;
+
+   for (i = 0;  i < nbytes;  i += 3)
+   {
+      bits = (unsigned int) bytes[i] << 16;
+      if (i + 1 < nbytes)
+         bits |= (unsigned int) bytes[i + 1] << 8;
+      if (i + 2 < nbytes)
+         bits |= (unsigned int) bytes[i + 2];
+
+      buf[len++] = packed_alphabet[(bits >> 18) & 0x3F];
+      buf[len++] = packed_alphabet[(bits >> 12) & 0x3F];
+      if (i + 1 < nbytes)
+         buf[len++] = packed_alphabet[(bits >> 6) & 0x3F];
+      if (i + 2 < nbytes)
+         buf[len++] = packed_alphabet[bits & 0x3F];
+   }
+
+   buf[len] = '\0';
+
+   return( len );
+}
+
+
+
+#else
+
+/* get the value of the given type back out of a 32 bit word */
+static double
+packed_value( char type, unsigned int word )
+{
+   union {
+      float f;
+      unsigned int u;
+   } w;
+
+
+   if ((type == 'u') || (type == 'm'))
+   {
+      if (word == PACKED_UNKNOWN)
+         return( -1.0 );
+
+      return( (type == 'm') ? (double) word * PACKED_MB : (double) word );
+   }
+
+   w.u = word;
+
+   return( (double) w.f );
+}
+
+
+
+/* Decode a packed value into at most max words.
+   Returns the number of words or -1 if the value is malformed. */
+static int
+packed_decode( const char *buf, unsigned int *words, int max )
+{
+   unsigned char bytes[4 * PACKED_MAX_VALUES + 3];
+   const char *c;
+   unsigned int bits;
+   int nbits,
+       nbytes,
+       i;
+
+
+   if (buf[0] != PACKED_VERSION)
+      return( -1 );
+
+   bits = 0;
+   nbits = 0;
+   nbytes = 0;
+
+   for (c = buf + 1;  *c != '\0';  c++)
+   {
+      const char *pos = strchr( packed_alphabet, *c );
+
+      if (pos == NULL)
+         return( -1 );
+
+      bits = (bits << 6) | (unsigned int) (pos - packed_alphabet);
+      nbits += 6;
+
+      if (nbits >= 8)
+      {
+         nbits -= 8;
+         if (nbytes == (int) sizeof( bytes ))
+            return( -1 );
+         bytes[nbytes++] = (unsigned char) (bits >> nbits);
+      }
+   }
+
+   if ((nbytes % 4) != 0)
+      return( -1 );
+
+   for (i = 0;  (i < nbytes / 4) && (i < max);  i++)
+      words[i] = ((unsigned int) bytes[4 * i] << 24)
+                 | ((unsigned int) bytes[4 * i + 1] << 16)
+                 | ((unsigned int) bytes[4 * i + 2] << 8)
+                 | (unsigned int) bytes[4 * i + 3];
+
+   return( i );
+}
+
+#endif
+
+#endif
@@ -0,0 +1,258 @@
+/******************************************************************************
+ *
+ *  Reader library for the shared memory snapshots published by mod_aixdisk
+ *  (see aixdisk_shm.h for the layout).
+ *
+ *  A reader which polls aixdisk_shm_latest() and reads every sequence
+ *  number it has not seen yet gets all snapshots as long as it keeps up
+ *  with nslots cycles.  If the module is restarted a new object replaces
+ *  the old one, so readers reopen once the latest sequence stops moving.
+ *
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "aixdisk_shm.h"
+
+
+struct aixdisk_shm_t {
+   const aixdisk_shm_header_t *header;
+   const char *base;
+   size_t size;
+};
+
+
+
+/* map a ring from an open descriptor, which is closed */
+static aixdisk_shm_t *
+shm_map_fd( int fd )
+{
+   aixdisk_shm_t *shm;
+   const aixdisk_shm_header_t *h;
+   struct stat st;
+   void *map;
+
+
+   if (fd < 0)
+      return( NULL );
+
+   if ((fstat( fd, &st ) != 0) || (st.st_size < (off_t) sizeof( aixdisk_shm_header_t )))
+   {
+      close( fd );
+      return( NULL );
+   }
+
+   map = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+   close( fd );
+
+   if (map == MAP_FAILED)
+      return( NULL );
+
+   h = map;
+
+/* only accept a layout this library knows and which fits the object */
+   if ((h->magic != AIXDISK_SHM_MAGIC)
+       || (h->version != AIXDISK_SHM_VERSION)
+       || (h->nslots == 0)
+       || (h->slot_size < sizeof( aixdisk_shm_slot_t ) + h->ndisks * h->nmetrics * sizeof( double ))
+       || (h->header_size + (h->ndisks + h->nmetrics) * AIXDISK_SHM_NAME_SIZE > h->slot_offset)
+       || ((size_t) h->slot_offset + (size_t) h->nslots * h->slot_size > (size_t) st.st_size))
+   {
+      munmap( map, st.st_size );
+      return( NULL );
+   }
+
+   shm = malloc( sizeof( aixdisk_shm_t ) );
+   if (shm == NULL)
+   {
+      munmap( map, st.st_size );
+      return( NULL );
+   }
+
+   shm->header = h;
+   shm->base = map;
+   shm->size = st.st_size;
+
+   return( shm );
+}
+
+
+
+aixdisk_shm_t *
+aixdisk_shm_open( const char *name )
+{
+   return( shm_map_fd( shm_open( name, O_RDONLY, 0 ) ) );
+}
+
+
+
+aixdisk_shm_t *
+aixdisk_shm_open_file( const char *path )
+{
+   return( shm_map_fd( open( path, O_RDONLY ) ) );
+}
+
+
+
+void
+aixdisk_shm_close( aixdisk_shm_t *shm )
+{
+   if (shm == NULL)
+      return;
+
+   munmap( (void *) shm->base, shm->size );
+   free( shm );
+}
+
+
+
+unsigned int
+aixdisk_shm_ndisks( const aixdisk_shm_t *shm )
+{
+   return( shm->header->ndisks );
+}
+
+
+
+unsigned int
+aixdisk_shm_nmetrics( const aixdisk_shm_t *shm )
+{
+   return( shm->header->nmetrics );
+}
+
+
+
+unsigned int
+aixdisk_shm_nslots( const aixdisk_shm_t *shm )
+{
+   return( shm->header->nslots );
+}
+
+
+
+const char *
+aixdisk_shm_disk_name( const aixdisk_shm_t *shm, unsigned int d )
+{
+   if (d >= shm->header->ndisks)
+      return( NULL );
+
+   return( shm->base + shm->header->header_size + d * AIXDISK_SHM_NAME_SIZE );
+}
+
+
+
+const char *
+aixdisk_shm_metric_name( const aixdisk_shm_t *shm, unsigned int m )
+{
+   if (m >= shm->header->nmetrics)
+      return( NULL );
+
+   return( shm->base + shm->header->header_size
+           + (shm->header->ndisks + m) * AIXDISK_SHM_NAME_SIZE );
+}
+
+
+
+int
+aixdisk_shm_metric_index( const aixdisk_shm_t *shm, const char *name )
+{
+   unsigned int m;
+
+
+   for (m = 0;  m < shm->header->nmetrics;  m++)
+      if (strncmp( name, aixdisk_shm_metric_name( shm, m ), AIXDISK_SHM_NAME_SIZE ) == 0)
+         return( m );
+
+   return( -1 );
+}
+
+
+
+unsigned long long
+aixdisk_shm_latest( const aixdisk_shm_t *shm )
+{
+   unsigned long long seq;
+
+
+   seq = shm->header->seq;
+   AIXDISK_SHM_BARRIER();
+
+   return( seq );
+}
+
+
+
+static const aixdisk_shm_slot_t *
+shm_slot( const aixdisk_shm_t *shm, unsigned long long seq )
+{
+   return( (const aixdisk_shm_slot_t *) (shm->base + shm->header->slot_offset
+                                         + (seq % shm->header->nslots) * shm->header->slot_size) );
+}
+
+
+
+const double *
+aixdisk_shm_peek( const aixdisk_shm_t *shm,
+                  unsigned long long seq,
+                  double *time )
+{
+   const aixdisk_shm_slot_t *slot;
+
+
+   if (seq == 0)
+      return( NULL );
+
+   slot = shm_slot( shm, seq );
+   if (slot->seq != 2 * seq)
+      return( NULL );
+
+   AIXDISK_SHM_BARRIER();
+
+   if (time != NULL)
+      *time = slot->time;
+
+   return( (const double *) (slot + 1) );
+}
+
+
+
+int
+aixdisk_shm_valid( const aixdisk_shm_t *shm, unsigned long long seq )
+{
+   AIXDISK_SHM_BARRIER();
+
+   return( (seq != 0) && (shm_slot( shm, seq )->seq == 2 * seq) );
+}
+
+
+
+int
+aixdisk_shm_read( const aixdisk_shm_t *shm,
+                  unsigned long long seq,
+                  double *time,
+                  double *values )
+{
+   const double *v;
+   double t;
+
+
+   v = aixdisk_shm_peek( shm, seq, &t );
+   if (v == NULL)
+      return( -1 );
+
+   memcpy( values, v, shm->header->ndisks * shm->header->nmetrics * sizeof( double ) );
+
+   if (! aixdisk_shm_valid( shm, seq ))
+      return( -1 );
+
+   if (time != NULL)
+      *time = t;
+
+   return( 0 );
+}
@@ -0,0 +1,104 @@
+/******************************************************************************
+ *
+ *  Shared memory export of the per cycle disk snapshots of mod_aixdisk.
+ *
+ *  When the shm_name module parameter is set, the module publishes every
+ *  snapshot it computes into a POSIX shared memory object of that name, so
+ *  other local processes can use its numbers instead of polling libperfstat
+ *  themselves.
+ *
+ *  The object starts with an aixdisk_shm_header_t, followed by the disk and
+ *  the metric names (AIXDISK_SHM_NAME_SIZE bytes each) and then nslots
+ *  slots of slot_size bytes.  A slot is an aixdisk_shm_slot_t followed by
+ *  ndisks * nmetrics doubles, value [m * ndisks + d] being metric m of
+ *  disk d.
+ *
+ *  The history_file parameter keeps a ring of the same layout in a regular
+ *  file, which survives restarts and is opened with aixdisk_shm_open_file().
+ *  Only the metrics listed in history_metrics are in it.
+ *
+ *  There is a single writer.  Snapshot number n goes into slot n % nslots,
+ *  the slot sequence is odd while it is written and 2 * n once it is
+ *  complete, after which the header sequence is set to n.  A reader copies
+ *  a slot and checks the slot sequence before and after the copy, a
+ *  mismatch means the writer lapped it and the read has to be retried.
+ *
+ ******************************************************************************/
+
+#ifndef AIXDISK_SHM_H
+#define AIXDISK_SHM_H
+
+
+#define AIXDISK_SHM_MAGIC 0x41585348   /* "AXSH" */
+#define AIXDISK_SHM_VERSION 1
+
+#define AIXDISK_SHM_NAME_SIZE 64
+
+
+#if defined(__GNUC__)
+#define AIXDISK_SHM_BARRIER() __sync_synchronize()
+#elif defined(__xlC__) || defined(__IBMC__)
+#define AIXDISK_SHM_BARRIER() __sync()
+#else
+#define AIXDISK_SHM_BARRIER()
+#endif
+
+
+struct aixdisk_shm_header_t {
+   unsigned int magic;
+   unsigned int version;
+   unsigned int header_size;     /* offset of the names */
+   unsigned int slot_offset;     /* offset of the first slot */
+   unsigned int slot_size;
+   unsigned int nslots;
+   unsigned int ndisks;
+   unsigned int nmetrics;
+   long long writer_pid;
+   volatile unsigned long long seq;  /* last complete snapshot, 0 = none */
+};
+
+typedef struct aixdisk_shm_header_t aixdisk_shm_header_t;
+
+
+struct aixdisk_shm_slot_t {
+   volatile unsigned long long seq;
+   double time;                  /* seconds since the epoch */
+};
+
+typedef struct aixdisk_shm_slot_t aixdisk_shm_slot_t;
+
+
+
+/* reader side, see aixdisk_shm.c */
+
+typedef struct aixdisk_shm_t aixdisk_shm_t;
+
+aixdisk_shm_t *aixdisk_shm_open( const char *name );
+aixdisk_shm_t *aixdisk_shm_open_file( const char *path );
+void aixdisk_shm_close( aixdisk_shm_t *shm );
+
+unsigned int aixdisk_shm_ndisks( const aixdisk_shm_t *shm );
+unsigned int aixdisk_shm_nmetrics( const aixdisk_shm_t *shm );
+unsigned int aixdisk_shm_nslots( const aixdisk_shm_t *shm );
+const char *aixdisk_shm_disk_name( const aixdisk_shm_t *shm, unsigned int d );
+const char *aixdisk_shm_metric_name( const aixdisk_shm_t *shm, unsigned int m );
+int aixdisk_shm_metric_index( const aixdisk_shm_t *shm, const char *name );
+
+/* sequence number of the latest complete snapshot, 0 if there is none */
+unsigned long long aixdisk_shm_latest( const aixdisk_shm_t *shm );
+
+/* Copy snapshot seq (ndisks * nmetrics values) into values.
+   Returns 0 on success, -1 if it has already been overwritten. */
+int aixdisk_shm_read( const aixdisk_shm_t *shm,
+                      unsigned long long seq,
+                      double *time,
+                      double *values );
+
+/* Zero copy access: the values of snapshot seq stay valid only as long as
+   aixdisk_shm_valid() returns true after they have been used. */
+const double *aixdisk_shm_peek( const aixdisk_shm_t *shm,
+                                unsigned long long seq,
+                                double *time );
+int aixdisk_shm_valid( const aixdisk_shm_t *shm, unsigned long long seq );
+
+#endif
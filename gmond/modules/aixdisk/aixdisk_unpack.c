@@ -0,0 +1,117 @@
+/******************************************************************************
+ *
+ *  Decoder for the packed metrics published by mod_aixdisk when the
+ *  packed_metrics module parameter is set (see aixdisk_packed.h).
+ *
+ *  usage: aixdisk_unpack <layout> <value> [<value> ...]
+ *
+ *  <layout> is either the metric description as published by gmond (the
+ *  part after the last ": " is used) or just the layout itself, e.g.
+ *
+ *     aixdisk_unpack "xfers:f,rbytes:f,q_full:u" "AQ5Kz..."
+ *
+ *  Every value is printed as one "<name> <value>" line per metric, unknown
+ *  values as -1.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PACKED_DECODER
+#include "aixdisk_packed.h"
+
+
+#define MAX_NAME_SIZE 64
+
+
+static int
+parse_layout( const char *desc,
+              char names[PACKED_MAX_VALUES][MAX_NAME_SIZE],
+              char *types )
+{
+   const char *layout,
+              *p,
+              *colon;
+   size_t len;
+   int n;
+
+
+   layout = strstr( desc, ": " );
+   while ((layout != NULL) && (strstr( layout + 2, ": " ) != NULL))
+      layout = strstr( layout + 2, ": " );
+   layout = (layout != NULL) ? layout + 2 : desc;
+
+   n = 0;
+   p = layout;
+
+   while ((*p != '\0') && (n < PACKED_MAX_VALUES))
+   {
+      len = strcspn( p, "," );
+      colon = memchr( p, ':', len );
+
+      if ((colon == NULL) || (colon - p >= MAX_NAME_SIZE) || (colon + 2 != p + len))
+         return( -1 );
+
+      memcpy( names[n], p, colon - p );
+      names[n][colon - p] = '\0';
+      types[n] = colon[1];
+
+      if ((types[n] != 'u') && (types[n] != 'm') && (types[n] != 'f'))
+         return( -1 );
+
+      n++;
+      p += len;
+      if (*p == ',')
+         p++;
+   }
+
+   return( n );
+}
+
+
+
+int main( int argc, char *argv[] )
+{
+   char names[PACKED_MAX_VALUES][MAX_NAME_SIZE],
+        types[PACKED_MAX_VALUES];
+   unsigned int words[PACKED_MAX_VALUES];
+   int n,
+       count,
+       i,
+       j;
+
+
+   if (argc < 3)
+   {
+      fprintf( stderr, "usage: %s <layout> <value> [<value> ...]\n", argv[0] );
+      return( 1 );
+   }
+
+   n = parse_layout( argv[1], names, types );
+   if (n < 0)
+   {
+      fprintf( stderr, "%s: invalid layout >%s<\n", argv[0], argv[1] );
+      return( 1 );
+   }
+
+   for (i = 2;  i < argc;  i++)
+   {
+      count = packed_decode( argv[i], words, PACKED_MAX_VALUES );
+      if (count != n)
+      {
+         fprintf( stderr, "%s: value >%s< does not match the layout\n", argv[0], argv[i] );
+         return( 2 );
+      }
+
+/* integers in full, floats with enough digits to read them back exactly */
+      for (j = 0;  j < count;  j++)
+         if (types[j] == 'f')
+            printf( "%s %.9g\n", names[j], packed_value( types[j], words[j] ) );
+         else
+            printf( "%s %.0f\n", names[j], packed_value( types[j], words[j] ) );
+   }
+
+   return( 0 );
+}
@@ -22,6 +22,8 @@
 
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <math.h>
 #include <string.h>
 #include <strings.h>
 #include <time.h>
@@ -31,10 +33,23 @@
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/utsname.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <syslog.h>
-
+#include <fnmatch.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <apr_general.h>
 #include <apr_tables.h>
 #include <apr_strings.h>
+#include <apr_hash.h>
 
 #include <libperfstat.h>
 #include <sys/var.h>
@@ -42,25 +57,118 @@
 
 #include "libmetrics.h"
 
+#include "aixdisk_packed.h"
+#include "aixdisk_shm.h"
+
+#if defined(AIXDISK_TRACE) && ! defined(__GNUC__)
+#include <sys/atomic_op.h>
+#endif
+
 
 /* See /usr/include/sys/iplcb.h to explain the below */
 #define XINTFRAC ((double)(_system_configuration.Xint)/(double)(_system_configuration.Xfrac))
 
 /* hardware ticks per millisecond */
-#define HWTICS2MSECS(x) ((double) x * XINTFRAC)/1000000.0
+#define HWTICS2MSECS(x) (((double) (x) * XINTFRAC) / 1000000.0)
 
 #ifndef FIRST_DISK
 #define FIRST_DISK ""
 #endif
 
 
-/* define for debugging output */
-#undef DEBUG
+/* The span tracing of the collection is only compiled in with
+   -DAIXDISK_TRACE (configure --enable-aixdisk-trace), it is switched on
+   by the trace_file parameter. */
 
 #define MIN_THRESHOLD 5.0
 
+/* records asked for at a time beyond the known disks of a range */
+#define RANGE_SLACK 16
+
+#define MAX_DISK_METRICS 64
+
+/* host level metrics registered after the per disk ones */
+#define MAX_HOST_METRICS 128
+
+/* disk groups defined by group_<name> parameters */
+#define MAX_DISK_GROUPS 16
+
+/* latency SLO rules and the default hysteresis of their clear level */
+#define MAX_SLO_RULES 8
+#define SLO_HYSTERESIS 0.1
+
+/* refresh interval for the static disk properties (size, bsize and, only
+   before AIX 5.3 where it is not yet the read transfer counter, xrate) */
+#define STATIC_REFRESH 600.0
+
+/* counter baselines persisted across restarts */
+#define STATE_MAGIC 0x41495844   /* "AIXD" */
+#define STATE_VERSION 3
+#define STATE_INTERVAL 60.0
+#define STATE_MAX_AGE 900.0
+
+/* default number of snapshots kept in the shared memory ring */
+#define SHM_SLOTS 16
+
+/* default number of snapshots kept in the history file, an hour at the
+   usual 15 second interval */
+#define HISTORY_SLOTS 240
+
+/* default number of spans kept by the tracing */
+#define TRACE_SPANS 65536
+
+/* local OpenMetrics endpoint */
+#define HTTP_ADDRESS "127.0.0.1"
+#define HTTP_TIMEOUT 2000        /* ms */
+#define HTTP_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+/* time the cleanup waits for the detached threads to stop */
+#define THREAD_EXIT_WAIT 2.0
+
 #define MAX_BUF_SIZE 1024
 
+/* disks missing from this many snapshots in a row are disabled and retried
+   after RETRY_BACKOFF seconds, doubling up to RETRY_BACKOFF_MAX */
+#define DISABLE_AFTER 3
+#define RETRY_BACKOFF 60.0
+#define RETRY_BACKOFF_MAX 3600.0
+
+/* disks read every cycle in incremental mode, by recent transfer rate */
+#define HOT_DISKS 4
+
+/* saturation score, weights of the utilization, the wait queue occupancy
+   and the service time inflation, which counts fully at SAT_INFLATION
+   times the baseline.  The baseline follows the service time of intervals
+   below SAT_BASELINE_BUSY percent busy with weight SAT_BASELINE_ALPHA. */
+#define SAT_WEIGHT_BUSY 0.4
+#define SAT_WEIGHT_QUEUE 0.3
+#define SAT_WEIGHT_SERV 0.3
+#define SAT_INFLATION 3.0
+#define SAT_BASELINE_BUSY 50.0
+#define SAT_BASELINE_ALPHA 0.05
+
+/* time constant in seconds with which old free values lose their weight
+   in the fill rate regression */
+#define FILL_WINDOW 86400.0
+
+/* values of the health metric */
+#define HEALTH_OK 0.0
+#define HEALTH_MISSING 1.0
+#define HEALTH_DISABLED 2.0
+
+/* one bit per entry in metrics_info, set when the value moved since it was
+   last handed to gmond */
+#define DIRTY_SET(i)   (aixdisk_dirty[(i) >> 3] |= (unsigned char) (1 << ((i) & 7)))
+#define DIRTY_CLEAR(i) (aixdisk_dirty[(i) >> 3] &= (unsigned char) ~(1 << ((i) & 7)))
+#define DIRTY_TEST(i)  (aixdisk_dirty[(i) >> 3] & (1 << ((i) & 7)))
+
+
+/*
+ * Declare ourselves so the configuration routines can find and know us.
+ * We'll fill it in at the end of the module.
+ */
+extern mmodule aixdisk_module;
+
 
 static time_t boottime;
 
@@ -70,8 +178,12 @@ static int allowDiskPerfCollection;
 
 struct aixdisk_t {
    int enabled;
+   int failures;
+   double backoff;
+   double retry_at;
    double last_read;
    double threshold;
+   unsigned int identity;        /* disk_identity() at the detection */
    char devName[MAX_G_STRING_SIZE];
 };
 
@@ -81,48 +193,707 @@ typedef struct aixdisk_t aixdisk_t;
 struct aixdisk_data_t {
    double last_value;
    double curr_value;
-   u_longlong_t last_total_value;
 };
 
 typedef struct aixdisk_data_t aixdisk_data_t;
 
 
+/* Exponentially weighted linear regression of the free space over time.
+   The sums are kept relative to the newest point, which keeps them small
+   and makes adding a point cheap. */
+struct aixdisk_fill_t {
+   double time;                  /* time and free value of the newest point */
+   double free;
+   double w;                     /* decayed sums of 1, t, f, t*t and t*f */
+   double t;
+   double f;
+   double tt;
+   double tf;
+};
+
+typedef struct aixdisk_fill_t aixdisk_fill_t;
+
+
 static unsigned int aixdisk_count = 0;
 
 static aixdisk_t *aixdisks = NULL;
 
-static aixdisk_data_t *aixdisk_size = NULL;
-static aixdisk_data_t *aixdisk_free = NULL;
-static aixdisk_data_t *aixdisk_bsize = NULL;
-static aixdisk_data_t *aixdisk_xrate = NULL;
-static aixdisk_data_t *aixdisk_xfers = NULL;
-static aixdisk_data_t *aixdisk_wbytes = NULL;
-static aixdisk_data_t *aixdisk_rbytes = NULL;
-static aixdisk_data_t *aixdisk_qdepth = NULL;
-static aixdisk_data_t *aixdisk_time = NULL;
-#ifdef _AIX53
-static aixdisk_data_t *aixdisk_q_full = NULL;
-static aixdisk_data_t *aixdisk_rserv = NULL;
-static aixdisk_data_t *aixdisk_rtimeout = NULL;
-static aixdisk_data_t *aixdisk_rfailed = NULL;
-static aixdisk_data_t *aixdisk_min_rserv = NULL;
-static aixdisk_data_t *aixdisk_max_rserv = NULL;
-static aixdisk_data_t *aixdisk_wserv = NULL;
-static aixdisk_data_t *aixdisk_wtimeout = NULL;
-static aixdisk_data_t *aixdisk_wfailed = NULL;
-static aixdisk_data_t *aixdisk_min_wserv = NULL;
-static aixdisk_data_t *aixdisk_max_wserv = NULL;
-static aixdisk_data_t *aixdisk_wq_depth = NULL;
-static aixdisk_data_t *aixdisk_wq_sampled = NULL;
-static aixdisk_data_t *aixdisk_wq_time = NULL;
-static aixdisk_data_t *aixdisk_wq_min_time = NULL;
-static aixdisk_data_t *aixdisk_wq_max_time = NULL;
+
+/* Raw perfstat counters which are turned into per interval deltas.  The
+   state file holds them in this order, a change of the counters or of the
+   fields behind them needs a new STATE_VERSION. */
+enum aixdisk_counter {
+   CTR_XFERS = 0,
+   CTR_RXFERS,
+   CTR_RBLKS,
+   CTR_WBLKS,
+   CTR_TIME,
+   CTR_WXFERS,         /* xfers - xrate */
+   CTR_Q_FULL,
+   CTR_RSERV,
+   CTR_WSERV,
+   CTR_WQ_SAMPLED,
+   CTR_WQ_TIME,
+   CTR_RTIMEOUT,
+   CTR_RFAILED,
+   CTR_WTIMEOUT,
+   CTR_WFAILED,
+   NUM_COUNTERS
+};
+
+/* the counters from CTR_Q_FULL on are only there with extended statistics */
+#define NUM_BASIC_COUNTERS CTR_Q_FULL
+
+/* perfstat_disk_t fields behind the counters */
+static const size_t counter_field[NUM_COUNTERS] = {
+   [CTR_XFERS] = offsetof( perfstat_disk_t, xfers ),
+   [CTR_RXFERS] = offsetof( perfstat_disk_t, xrate ),   /* read transfers since AIX 5.3 */
+   [CTR_RBLKS] = offsetof( perfstat_disk_t, rblks ),
+   [CTR_WBLKS] = offsetof( perfstat_disk_t, wblks ),
+   [CTR_TIME] = offsetof( perfstat_disk_t, time ),
+   [CTR_WXFERS] = offsetof( perfstat_disk_t, xfers ),   /* minus xrate, see store_disk() */
+   [CTR_Q_FULL] = offsetof( perfstat_disk_t, q_full ),
+   [CTR_RSERV] = offsetof( perfstat_disk_t, rserv ),
+   [CTR_WSERV] = offsetof( perfstat_disk_t, wserv ),
+   [CTR_WQ_SAMPLED] = offsetof( perfstat_disk_t, wq_sampled ),
+   [CTR_WQ_TIME] = offsetof( perfstat_disk_t, wq_time ),
+   [CTR_RTIMEOUT] = offsetof( perfstat_disk_t, rtimeout ),
+   [CTR_RFAILED] = offsetof( perfstat_disk_t, rfailed ),
+   [CTR_WTIMEOUT] = offsetof( perfstat_disk_t, wtimeout ),
+   [CTR_WFAILED] = offsetof( perfstat_disk_t, wfailed )
+};
+
+/* counters are stored columnar, one array over all disks per counter */
+static u_longlong_t *ctr_total[NUM_COUNTERS];
+static u_longlong_t *ctr_last_total[NUM_COUNTERS];
+static double *ctr_delta[NUM_COUNTERS];
+
+static double *disk_delta_t = NULL;
+static double *serv_baseline = NULL;
+
+/* free space regression, refreshed only when the free space changed */
+static aixdisk_fill_t *disk_fill = NULL;
+static double fill_window = FILL_WINDOW;
+static double saturation_max = 0.0;
+static char *disk_seen = NULL;
+static char *disk_due = NULL;
+
+/* Disks whose counters did not move in this and the previous interval.
+   Their values computed from the deltas are the same as last time, so
+   they are not compared again.  The rates, deltas and ratios of all deltas
+   being zero are recomputed in the columnar pass anyway, the derived
+   values only for the disks in disk_active (disk_active_count of them). */
+static char *disk_moved = NULL;
+static char *disk_idle = NULL;
+static char *disk_quiet = NULL;
+static unsigned int *disk_active = NULL;
+static unsigned int disk_active_count = 0;
+
+/* snapshot buffer of disk_stats_capacity records, it grows when disks
+   were added since the init */
+static perfstat_disk_t *disk_stats = NULL;
+static int disk_stats_capacity = 0;
+
+/* Size of the perfstat_disk_t records libperfstat fills in, the largest
+   it accepts.  Headers of later levels add fields after q_sampled, the
+   end of the AIX 5.3 structure.  Levels before AIX 5.3 only know the
+   fields up to q_full, without the extended statistics. */
+#define DISK_SIZE_AIX53 (offsetof( perfstat_disk_t, q_sampled ) + sizeof( u_longlong_t ))
+#define DISK_SIZE_BASIC offsetof( perfstat_disk_t, q_full )
+
+static int disk_stat_size = sizeof( perfstat_disk_t );
+static int disk_extended = TRUE;
+static unsigned int active_counters = NUM_COUNTERS;
+
+#define STAT_RECORD(buffer, i) \
+   ((perfstat_disk_t *) ((char *) (buffer) + (size_t) (i) * disk_stat_size))
+
+#define DISK_STAT(i) STAT_RECORD( disk_stats, i )
+
+/* static disk properties are served from cache between refreshes */
+static double static_refresh = STATIC_REFRESH;
+static double static_last_read = 0.0;
+static int static_last_count = 0;
+
+/* health tracking */
+static int disable_after = DISABLE_AFTER;
+static double retry_backoff = RETRY_BACKOFF;
+
+/* partition configuration fingerprint, a change by Live Partition
+   Mobility or DLPAR invalidates the interval it falls into */
+static unsigned int config_xint = 0;
+static unsigned int config_xfrac = 0;
+static int config_ncpus = 0;
+static int config_changed = FALSE;
+static char *disk_rebase = NULL;   /* next delta of the disk is a new baseline */
+
+/* incremental collection, collect_budget disks per cycle in rotation plus
+   the hot_disk_count most active ones (0 = all disks every cycle) */
+static int collect_budget = 0;
+static int hot_disk_count = 0;
+static int hot_disk_used = 0;
+static int *hot_disks = NULL;
+static int rotate_next = 0;
+
+
+/* layout of the memory mapped state file */
+struct aixdisk_state_header_t {
+   unsigned int magic;
+   unsigned int version;
+   unsigned int disk_count;
+   unsigned int counter_count;
+   unsigned int counter_layout;  /* state_layout() of the writer */
+   unsigned int reserved;
+   long long boottime;
+   double saved;                 /* get_monotonic_time() of the save */
+};
+
+typedef struct aixdisk_state_header_t aixdisk_state_header_t;
+
+
+struct aixdisk_state_disk_t {
+   char devName[MAX_G_STRING_SIZE];
+   unsigned int identity;        /* disk_identity() of the disk */
+   unsigned int reserved;
+   double last_read;             /* get_monotonic_time() of the last read */
+   u_longlong_t last_total[NUM_COUNTERS];
+};
+
+typedef struct aixdisk_state_disk_t aixdisk_state_disk_t;
+
+
+static const char *state_file = NULL;
+static int state_fd = -1;
+static aixdisk_state_header_t *state_map = NULL;
+static size_t state_size = 0;
+
+/* shared memory ring of the per cycle snapshots, see aixdisk_shm.h */
+static const char *shm_name = NULL;
+static int shm_slots = SHM_SLOTS;
+static aixdisk_shm_header_t *shm_map = NULL;
+static size_t shm_size = 0;
+static unsigned int shm_metric[MAX_DISK_METRICS];
+
+/* memory mapped history file, a ring of history_slots snapshots of the
+   history metrics in the layout of the shared memory ring which survives
+   restarts */
+static int history_slots = HISTORY_SLOTS;
+static aixdisk_shm_header_t *history_map = NULL;
+static size_t history_size = 0;
+static unsigned int history_metric[MAX_DISK_METRICS];
+static unsigned int history_metric_count = 0;
+
+#ifdef AIXDISK_TRACE
+/* span tracing, the spans are kept in the ring trace_buf of trace_size
+   spans and appended to trace_file as Chrome trace events every
+   trace_interval seconds, whenever half the ring is filled and at the
+   end.  trace_written is the number of the next span to write. */
+struct aixdisk_span_t {
+   volatile long seq;            /* span number + 1 once complete */
+   const char *name;
+   double begin;                 /* us */
+   double end;
+   unsigned long tid;
+   int arg;
+};
+
+typedef struct aixdisk_span_t aixdisk_span_t;
+
+static int trace_enabled = FALSE;
+static aixdisk_span_t *trace_buf = NULL;
+static unsigned int trace_size = TRACE_SPANS;
+static volatile long trace_next = 0;
+static long trace_written = 0;
+static long trace_events = 0;
+static long trace_lost = 0;
+static const char *trace_file = NULL;
+static FILE *trace_fp = NULL;
+static double trace_interval = 0.0;
+static double trace_dumped = 0.0;
+
+/* the span numbers are handed out by an atomic increment, recording a
+   span takes no lock */
+#if defined(__GNUC__)
+#define TRACE_NEXT() __sync_fetch_and_add( &trace_next, 1 )
+#else
+#define TRACE_NEXT() fetch_and_addlp( (atomic_l) &trace_next, 1 )
+#endif
+
+/* Run stmt as span name.  Without tracing this costs the test of
+   trace_enabled, arg is evaluated after stmt. */
+#define TRACE_SPAN(name, arg, stmt) \
+   do { \
+      if (trace_enabled) \
+      { \
+         double trace_begin_ = trace_now(); \
+         stmt; \
+         trace_span( name, trace_begin_, arg ); \
+      } \
+      else \
+      { \
+         stmt; \
+      } \
+   } while (0)
+#else
+#define TRACE_SPAN(name, arg, stmt) do { stmt; } while (0)
 #endif
 
+/* OpenMetrics endpoint, scrapes are rendered from the current snapshot
+   under snapshot_lock into the reused http_buf */
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t http_thread;
+static int http_fd = -1;
+static volatile int http_stop = FALSE;
+static char *http_buf = NULL;
+static size_t http_buf_size = 0;
+static double snapshot_time = 0.0;
+
+/* the collector, workers and sampler are detached so a hung perfstat call
+   does not block gmond's shutdown, they are counted in threads_running
+   until they return */
+static pthread_mutex_t thread_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t thread_exit = PTHREAD_COND_INITIALIZER;
+static int threads_running = 0;
+
+/* deadline bounded collection, the perfstat calls run in collect_thread
+   and the callbacks wait for them at most collect_deadline seconds */
+static double collect_deadline = 0.0;
+static int collect_running = FALSE;
+static pthread_t collect_thread;
+static pthread_mutex_t collect_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t collect_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t collect_done = PTHREAD_COND_INITIALIZER;
+static int collect_stop = FALSE;
+static int collect_busy = FALSE;
+static struct timespec collect_until;
+static int collect_count = 0;
+static int collect_ncpus = 1;
+static double collect_time = 0.0;
+static int snapshot_stale = FALSE;
+
+/* parallel collection, a snapshot is read in contiguous name ranges, one
+   per worker thread into its own buffer, and merged into disk_stats */
+static int collect_workers = 0;
+static pthread_t *worker_thread = NULL;
+static pthread_mutex_t worker_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t worker_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t worker_done = PTHREAD_COND_INITIALIZER;
+static unsigned int worker_round = 0;
+static int worker_pending = 0;
+static int worker_stop = FALSE;
+static int *chunk_first = NULL;
+static int *chunk_count = NULL;
+static perfstat_disk_t **chunk_stats = NULL;
+static int *chunk_capacity = NULL;
+
+/* peak sampler, a snapshot of the disks marked in peak_want every
+   peak_interval seconds between the cycles keeps the highest rate of the
+   peak counters per disk, -1.0 until the first sample of a cycle */
+static double peak_interval = 0.0;
+static int peak_running = FALSE;
+static pthread_t peak_thread;
+static pthread_mutex_t peak_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t peak_cond = PTHREAD_COND_INITIALIZER;
+static int peak_stop = FALSE;
+static perfstat_disk_t *peak_stats = NULL;
+static int peak_capacity = 0;
+static char *peak_want = NULL;
+static double *peak_time = NULL;
+static int peak_counter[NUM_COUNTERS];
+static int peak_counter_count = 0;
+static u_longlong_t *peak_last[NUM_COUNTERS];
+static double *peak_max[NUM_COUNTERS];
+
+/* per disk metrics, in registration order */
+enum aixdisk_metric {
+   M_SIZE = 0,
+   M_FREE,
+   M_BSIZE,
+   M_XRATE,
+   M_XFERS,
+   M_WBYTES,
+   M_RBYTES,
+   M_QDEPTH,
+   M_TIME,
+   M_HEALTH,
+   M_FILL_RATE,
+   M_TIME_TO_FULL,
+   M_Q_FULL,
+   M_RSERV,
+   M_RTIMEOUT,
+   M_RFAILED,
+   M_MIN_RSERV,
+   M_MAX_RSERV,
+   M_WSERV,
+   M_WTIMEOUT,
+   M_WFAILED,
+   M_MIN_WSERV,
+   M_MAX_WSERV,
+   M_WQ_DEPTH,
+   M_WQ_SAMPLED,
+   M_WQ_TIME,
+   M_WQ_MIN_TIME,
+   M_WQ_MAX_TIME,
+   M_RPS,
+   M_WPS,
+   M_AVG_RSIZE,
+   M_AVG_WSIZE,
+   M_BUSY,
+   M_AVG_SERV,
+   M_AVG_WQTIME,
+   M_AVG_WQSZ,
+   M_AVG_SQSZ,
+   M_RTIMEOUT_DELTA,
+   M_RTIMEOUT_RATE,
+   M_RFAILED_DELTA,
+   M_RFAILED_RATE,
+   M_WTIMEOUT_DELTA,
+   M_WTIMEOUT_RATE,
+   M_WFAILED_DELTA,
+   M_WFAILED_RATE,
+   M_Q_FULL_RATE,
+   M_NEW_ERRORS,
+   M_SATURATION,
+   M_XFERS_PEAK,
+   M_RBYTES_PEAK,
+   M_WBYTES_PEAK,
+   NUM_METRICS
+};
+
+/* the metrics from M_Q_FULL on are only there with extended statistics,
+   the ones from M_XFERS_PEAK on only with the peak sampler */
+#define NUM_BASIC_METRICS M_Q_FULL
+#define FIRST_PEAK_METRIC M_XFERS_PEAK
+
+/* how the value of a metric is obtained, the kinds from KIND_RATE to
+   KIND_DERIVED are computed from the counter deltas alone */
+enum aixdisk_metric_kind {
+   KIND_STATE = 0,     /* maintained by the collection itself */
+   KIND_STATIC,        /* field * scale, only read on a static refresh */
+   KIND_GAUGE,         /* field * scale */
+   KIND_RATE,          /* counter delta * scale per second */
+   KIND_DELTA,         /* counter delta * scale */
+   KIND_RATIO,         /* counter delta * scale / delta of the per counter */
+   KIND_DERIVED,       /* derive( disk, delta_t ) */
+   KIND_PEAK           /* highest sampled counter rate * scale */
+};
+
+#define KIND_FROM_DELTAS(k) (((k) >= KIND_RATE) && ((k) <= KIND_DERIVED))
+
+/* additional factor on top of the scale of a metric */
+enum aixdisk_scale_by {
+   SCALE_NONE = 0,
+   SCALE_TICKS,        /* hardware ticks to ms */
+   SCALE_BSIZE,        /* block size of the disk */
+   SCALE_CPUS          /* 1 / number of CPUs */
+};
+
+struct aixdisk_metric_def_t {
+   const char *name;
+   const char *desc;
+   const char *units;
+   enum aixdisk_metric_kind kind;
+   size_t field;                 /* offset of the perfstat_disk_t field */
+   int counter;
+   int per;
+   double scale;
+   enum aixdisk_scale_by scale_by;
+   double (*derive)( unsigned int i, double dt );
+   char packed;                  /* packed type, 'u', 'm' or 0 for 'f' */
+};
+
+typedef struct aixdisk_metric_def_t aixdisk_metric_def_t;
+
+
+/* per metric data arrays in registration order, i.e. the value behind
+   metrics_info[m * aixdisk_count + devIndex] is aixdisk_metric_data[m][devIndex],
+   which is metric aixdisk_metric_id[m] of the table */
+static unsigned int aixdisk_metric_count = 0;
+static aixdisk_data_t **aixdisk_metric_data = NULL;
+static unsigned int aixdisk_metric_id[MAX_DISK_METRICS];
+
+/* the same data arrays by table index, NULL if not registered */
+static aixdisk_data_t *metric_values[NUM_METRICS];
+static const char *aixdisk_metric_name[MAX_DISK_METRICS];
+static const char *aixdisk_metric_desc[MAX_DISK_METRICS];
+
+/* host level metrics, metrics_info[host_metric_base + h] is served by
+   host_metric_func[h]( host_metric_arg[h] ) */
+typedef g_val_t (*host_metric_func_t)( int arg );
+
+static unsigned int host_metric_base = 0;
+static unsigned int host_metric_count = 0;
+static host_metric_func_t host_metric_func[MAX_HOST_METRICS];
+static int host_metric_arg[MAX_HOST_METRICS];
+
+/* disk groups, the rollups of a group are computed over its member list
+   which is compiled once from the name patterns */
+enum aixdisk_group_value {
+   GRP_XFERS = 0,
+   GRP_RBYTES,
+   GRP_WBYTES,
+   GRP_BUSY,
+   GRP_AVG_SERV,        /* extended statistics only */
+   NUM_GROUP_VALUES
+};
+
+struct aixdisk_group_t {
+   char *name;
+   int *members;
+   int count;
+   double value[NUM_GROUP_VALUES];
+};
+
+typedef struct aixdisk_group_t aixdisk_group_t;
+
+static int group_count = 0;
+static aixdisk_group_t disk_groups[MAX_DISK_GROUPS];
+
+/* latency SLO rules, a disk enters breach of a rule above its threshold
+   and leaves it again below threshold * (1 - hysteresis) */
+struct slo_rule_t {
+   unsigned int metric;
+   double threshold;
+   double clear;
+};
+
+typedef struct slo_rule_t slo_rule_t;
+
+static int slo_count = 0;
+static slo_rule_t slo_rules[MAX_SLO_RULES];
+static unsigned char *slo_state = NULL;   /* per disk bit mask of breached rules */
+static int slo_syslog = FALSE;
+static unsigned int slo_breaches = 0;
+static char slo_list[MAX_G_STRING_SIZE];
+
+/* send-on-change state: last value handed to gmond and the dirty bitmap */
+static double change_epsilon = 0.0;
+static double *aixdisk_published = NULL;
+static unsigned char *aixdisk_dirty = NULL;
+
+/* packed mode: one string metric per disk carrying the selected metrics */
+static int packed_mode = FALSE;
+static int packed_count = 0;
+static unsigned int packed_metric[PACKED_MAX_VALUES];
+static char packed_type[PACKED_MAX_VALUES];
+static char (*packed_cache)[MAX_G_STRING_SIZE] = NULL;
+
 static apr_pool_t *pool;
 
 static apr_array_header_t *metric_info = NULL;
 
+/* units, slopes, formats and descriptions are shared by all disks */
+static apr_hash_t *interned_strings = NULL;
+
+/* disks which showed up after the init, they are only reported after a
+   restart */
+static apr_hash_t *added_disks = NULL;
+static unsigned int added_count = 0;
+
+
+
+static const char *
+get_module_param( const char *name )
+{
+   mmparam *params;
+   int i;
+
+
+   if (aixdisk_module.module_params_list == NULL)
+      return( NULL );
+
+   params = (mmparam *) aixdisk_module.module_params_list->elts;
+
+   for (i = 0;  i < aixdisk_module.module_params_list->nelts;  i++)
+      if (strcasecmp( name, params[i].name ) == 0)
+         return( params[i].value );
+
+   return( NULL );
+}
+
+
+
+#ifdef AIXDISK_TRACE
+/* monotonic time in microseconds */
+static double
+trace_now( void )
+{
+   struct timespec ts;
+
+
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+
+   return( (double) ts.tv_sec * 1000000.0 + (double) ts.tv_nsec / 1000.0 );
+}
+
+
+
+/* Record a span which began at begin and ends now, the oldest span is
+   overwritten once the buffer is full.  The slot sequence is 0 while it
+   is written, like the slots of the shared memory ring. */
+static void
+trace_span( const char *name, double begin, int arg )
+{
+   aixdisk_span_t *span;
+   double end = trace_now();
+   long n;
+
+
+   n = TRACE_NEXT();
+   span = &trace_buf[n % trace_size];
+
+   span->seq = 0;
+   AIXDISK_SHM_BARRIER();
+
+   span->name = name;
+   span->begin = begin;
+   span->end = end;
+   span->tid = (unsigned long) pthread_self();
+   span->arg = arg;
+
+   AIXDISK_SHM_BARRIER();
+   span->seq = n + 1;
+}
+
+
+
+/* Append the spans recorded since the last call to the trace file, in
+   the JSON array format of the Chrome trace events which loads into
+   chrome://tracing or Perfetto even before the closing bracket is
+   written.  Spans overwritten in the ring meanwhile are counted as lost,
+   a span still being written is left for the next call. */
+static void
+trace_dump( void )
+{
+   aixdisk_span_t span;
+   long first,
+        last,
+        n;
+   long pid = (long) getpid();
+
+
+   last = trace_next;
+   AIXDISK_SHM_BARRIER();
+
+   first = trace_written;
+   if (last - first > (long) trace_size)
+   {
+      trace_lost += last - (long) trace_size - first;
+      first = last - (long) trace_size;
+   }
+
+   for (n = first;  n < last;  n++)
+   {
+      if (trace_buf[n % trace_size].seq < n + 1)
+         break;
+
+      AIXDISK_SHM_BARRIER();
+      memcpy( &span, &trace_buf[n % trace_size], sizeof( span ) );
+      AIXDISK_SHM_BARRIER();
+
+      if ((span.seq != n + 1) || (trace_buf[n % trace_size].seq != n + 1))
+      {
+         trace_lost++;
+         continue;
+      }
+
+      fprintf( trace_fp, "%s{\"name\":\"%s\",\"cat\":\"aixdisk\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                         "\"pid\":%ld,\"tid\":%lu,\"args\":{\"n\":%d}}",
+               (trace_events++ > 0) ? ",\n" : "",
+               span.name, span.begin, span.end - span.begin, pid, span.tid, span.arg );
+   }
+
+   trace_written = n;
+
+   if (fflush( trace_fp ) != 0)
+      syslog( LOG_WARNING, "aixdisk: cannot write trace file %s: %s", trace_file, strerror( errno ) );
+}
+
+
+
+/* Switch the tracing on when a trace file is configured, before the
+   devices are enumerated so that is traced as well */
+static void
+init_trace( void )
+{
+   const char *value;
+
+
+   trace_file = get_module_param( "trace_file" );
+   if ((trace_file == NULL) || (*trace_file == '\0'))
+      return;
+
+   value = get_module_param( "trace_spans" );
+   if ((value != NULL) && (atoi( value ) > 0))
+      trace_size = atoi( value );
+
+   value = get_module_param( "trace_interval" );
+   if (value != NULL)
+      trace_interval = atof( value );
+
+   trace_buf = calloc( trace_size, sizeof( aixdisk_span_t ) );
+   if (trace_buf == NULL)
+   {
+      syslog( LOG_WARNING, "aixdisk: no memory for %u trace spans, tracing disabled", trace_size );
+      return;
+   }
+
+   trace_fp = fopen( trace_file, "w" );
+   if (trace_fp == NULL)
+   {
+      syslog( LOG_WARNING, "aixdisk: cannot write trace file %s: %s, tracing disabled",
+              trace_file, strerror( errno ) );
+      free( trace_buf );
+      trace_buf = NULL;
+      return;
+   }
+
+   fputs( "[\n", trace_fp );
+
+   trace_dumped = trace_now();
+   trace_enabled = TRUE;
+}
+
+
+
+/* write the trace when the interval is due or half the ring is filled */
+static void
+check_trace( void )
+{
+   if ((trace_next - trace_written >= (long) trace_size / 2)
+       || ((trace_interval > 0.0) && (trace_now() - trace_dumped >= trace_interval * 1000000.0)))
+   {
+      trace_dumped = trace_now();
+      trace_dump();
+   }
+}
+
+
+
+/* Write the remaining spans and close the array.  Only the gmond thread
+   writes the file, the span of a thread still stuck in a perfstat call
+   is missing and one which ends later is recorded into the ring, which
+   is kept for that, but not written. */
+static void
+close_trace( void )
+{
+   if (! trace_enabled)
+      return;
+
+   trace_enabled = FALSE;
+
+   trace_dump();
+
+   fputs( "\n]\n", trace_fp );
+   fclose( trace_fp );
+   trace_fp = NULL;
+
+   if (trace_lost > 0)
+      syslog( LOG_NOTICE, "aixdisk: %ld trace spans were overwritten before they were written to %s",
+              trace_lost, trace_file );
+}
+#endif
+
 
 
 static time_t
@@ -159,24 +930,74 @@ boottime_func_CALLED_ONCE( void )
 
 
 
+/* Fingerprint of the disk behind a name, its size, volume group and
+   description, so the baselines of a disk are not taken over by another
+   one which got its name */
+static unsigned int
+disk_identity( const perfstat_disk_t *disk )
+{
+   const unsigned char *b;
+   unsigned int h = 2166136261U;
+   size_t n;
+
+
+   b = (const unsigned char *) &disk->size;
+   for (n = 0;  n < sizeof( disk->size );  n++)
+      h = (h ^ b[n]) * 16777619U;
+
+   for (n = 0;  (n < IDENTIFIER_LENGTH) && (disk->vgname[n] != '\0');  n++)
+      h = (h ^ (unsigned char) disk->vgname[n]) * 16777619U;
+
+   h = (h ^ '/') * 16777619U;
+
+   for (n = 0;  (n < IDENTIFIER_LENGTH) && (disk->description[n] != '\0');  n++)
+      h = (h ^ (unsigned char) disk->description[n]) * 16777619U;
+
+   return( h );
+}
+
+
+
 static int
 detect_aixdisk_devices( void )
 {
+   static const int level_size[] = {
+      sizeof( perfstat_disk_t ), DISK_SIZE_AIX53, DISK_SIZE_BASIC
+   };
    int count,
+       l,
        i;
    perfstat_disk_t *p;
    perfstat_id_t name;
 
 
-/* find out the number of available AIX disks */
+/* find out the number of available AIX disks, and the largest structure
+   libperfstat knows (it rejects unknown structure sizes), from the one
+   of the headers down to the one before AIX 5.3 */
+
+   count = -1;
+
+   for (l = 0;  (count == -1) && (l < (int) (sizeof( level_size ) / sizeof( level_size[0] )));  l++)
+   {
+      if ((l > 0) && (level_size[l] >= level_size[l - 1]))
+         continue;
+
+      count = perfstat_disk( NULL, NULL, level_size[l], 0 );
+      if (count >= 0)
+         disk_stat_size = level_size[l];
+   }
 
-   count = perfstat_disk( NULL, NULL, sizeof( perfstat_disk_t ), 0 );
    if (count == -1)
       count = 0;
 
-#ifdef DEBUG
-fprintf( stderr, "Found AIX disks = %d\n", count );  fflush( stderr );
-#endif
+   if (disk_stat_size == DISK_SIZE_BASIC)
+   {
+      disk_extended = FALSE;
+      active_counters = NUM_BASIC_COUNTERS;
+      syslog( LOG_INFO, "aixdisk: no extended disk statistics available" );
+   }
+   else if (disk_stat_size < (int) sizeof( perfstat_disk_t ))
+      syslog( LOG_INFO, "aixdisk: disk statistics of the AIX 5.3 level" );
 
    if (count > 0)
    {
@@ -186,7 +1007,7 @@ fprintf( stderr, "Found AIX disks = %d\n", count );  fflush( stderr );
 /* ask to get all the structures available in one call */
 /* return code is number of structures returned */
       strcpy( name.name, FIRST_DISK );
-      i = perfstat_disk( &name, p, sizeof( perfstat_disk_t ), count );
+      i = perfstat_disk( &name, p, disk_stat_size, count );
 
       if (i == -1)
       {
@@ -194,6 +1015,11 @@ fprintf( stderr, "Found AIX disks = %d\n", count );  fflush( stderr );
          exit( 4 );
       }
 
+/* keep the buffer for the per cycle snapshots, records are
+   disk_stat_size apart from here on */
+      disk_stats = p;
+      disk_stats_capacity = count;
+
 
 /* allocate the proper data structures */
 
@@ -204,21 +1030,18 @@ fprintf( stderr, "Found AIX disks = %d\n", count );  fflush( stderr );
       for (i = 0;  i < count;  i++)
       {
          aixdisks[i].enabled = TRUE;
+         aixdisks[i].failures = 0;
+         aixdisks[i].backoff = 0.0;
+         aixdisks[i].retry_at = 0.0;
          aixdisks[i].threshold = MIN_THRESHOLD;
+         aixdisks[i].identity = disk_identity( DISK_STAT( i ) );
 
-         strcpy( aixdisks[i].devName, p[i].name );
+         strcpy( aixdisks[i].devName, DISK_STAT( i )->name );
       }
    }
    else
       return( 0 );
 
-#ifdef DEBUG
-for (i = 0;  i < count;  i++)
-   fprintf( stderr, "name = >%s<\n", aixdisks[i].devName );
-fflush( stderr );
-#endif
-
-
 /* return the number of found AIX disks */
    return( count );
 }
@@ -227,1461 +1050,4043 @@ fflush( stderr );
 #define NONZERO(x) ((x)?(x):1)
 
 
-static void
-read_disk( int devIndex, double delta_t, double now )
+
+/* Return the single pool copy of the given string */
+static char *
+intern_string( apr_pool_t *p, const char *s )
 {
-   perfstat_disk_t d;
-   perfstat_id_t id;
-   long long delta, dx1, dx2;
-   int count;
-   static int nCPUs = 0;
+   char *copy;
 
 
-/* get the number of CPUs */
-   nCPUs = perfstat_cpu( NULL, NULL, sizeof( perfstat_cpu_t ), 0 );
+   if (interned_strings == NULL)
+      interned_strings = apr_hash_make( p );
 
+   copy = apr_hash_get( interned_strings, s, APR_HASH_KEY_STRING );
+   if (copy == NULL)
+   {
+      copy = apr_pstrdup( p, s );
+      apr_hash_set( interned_strings, copy, APR_HASH_KEY_STRING, copy );
+   }
 
-#ifdef DEBUG
-fprintf( stderr, "\n" );
-fprintf( stderr, "devIndex = %d, now = %f, last_read = %f, delta_t = %f\n",
-                 devIndex,
-                 now,
-                 aixdisks[devIndex].last_read,
-                 delta_t );
-fflush( stderr );
-#endif
+   return( copy );
+}
 
 
-/* try to read the specified disk */
 
-   strcpy( id.name , aixdisks[devIndex].devName );
+/* Turn one counter column into per interval deltas over all disks.
+   A negative delta (counter reset or wrap) is stored as -1.0 so that the
+   rate pass keeps the previous value for that disk.  moved[i] is set for
+   every disk whose counter changed.
+   The loop body is branch free so the compiler can vectorize it.
+*/
+static void
+counter_deltas( unsigned int n,
+                const u_longlong_t *total,
+                u_longlong_t *last_total,
+                double *delta,
+                char *moved )
+{
+   unsigned int i;
+   double d;
 
-   count = perfstat_disk( &id, &d, sizeof( perfstat_disk_t ), 1 );
 
-   if (count == 1)
+   for (i = 0;  i < n;  i++)
    {
-      aixdisk_size[devIndex].curr_value = d.size * 1024.0 * 1024.0;
+      d = (double) (long long) (total[i] - last_total[i]);
+      delta[i] = (d < 0.0) ? -1.0 : d;
+      moved[i] |= (total[i] != last_total[i]);
+      last_total[i] = total[i];
+   }
+}
 
-      aixdisk_free[devIndex].curr_value = d.free * 1024.0 * 1024.0;
 
-      aixdisk_bsize[devIndex].curr_value = d.bsize;
+/* Select the new value if the delta is valid, the previous one otherwise.
+   The new value is computed either way, so the select is a blend of two
+   values and the loops over the disks have no branch to vectorize
+   around. */
+#define UPDATE(data, ok, expr) \
+   do { \
+      double new_ = (expr); \
+      data[i].curr_value = (ok) ? new_ : data[i].last_value; \
+      data[i].last_value = data[i].curr_value; \
+   } while (0)
 
-      aixdisk_xrate[devIndex].curr_value = d.xrate * 1024.0;
 
+/* Derived values.  They are computed in table order, so they may use the
+   values of the metrics above them.  A negative result keeps the previous
+   value. */
 
-      delta = d.xfers - aixdisk_xfers[devIndex].last_total_value;
-      if (delta < 0LL)
-         aixdisk_xfers[devIndex].curr_value = aixdisk_xfers[devIndex].last_value;
-      else
-         aixdisk_xfers[devIndex].curr_value = delta / delta_t;
-      aixdisk_xfers[devIndex].last_value = aixdisk_xfers[devIndex].curr_value;
+static double tick2ms = 1.0;
 
 
+static double
+derive_wq_time( unsigned int i, double dt )
+{
+   if (ctr_delta[CTR_WQ_TIME][i] < 0.0)
+      return( -1.0 );
 
-      delta = d.wblks - aixdisk_wbytes[devIndex].last_total_value;
-      if (delta < 0LL)
-         aixdisk_wbytes[devIndex].curr_value = aixdisk_wbytes[devIndex].last_value;
-      else
-         aixdisk_wbytes[devIndex].curr_value = (delta / delta_t) * d.bsize;
-      aixdisk_wbytes[devIndex].last_value = aixdisk_wbytes[devIndex].curr_value;
+   return( ctr_delta[CTR_WQ_TIME][i] * tick2ms / NONZERO( ctr_delta[CTR_XFERS][i] ) / dt );
+}
 
 
-      delta = d.rblks - aixdisk_rbytes[devIndex].last_total_value;
-      if (delta < 0LL)
-         aixdisk_rbytes[devIndex].curr_value = aixdisk_rbytes[devIndex].last_value;
-      else
-         aixdisk_rbytes[devIndex].curr_value = (delta / delta_t) * d.bsize;
-      aixdisk_rbytes[devIndex].last_value = aixdisk_rbytes[devIndex].curr_value;
+static double
+derive_busy( unsigned int i, double dt )
+{
+   double busy = metric_values[M_TIME][i].curr_value;
 
 
-      aixdisk_qdepth[devIndex].curr_value = d.qdepth;
+   return( (busy > 100.0) ? 100.0 : busy );
+}
 
-      
-      delta = d.time - aixdisk_time[devIndex].last_total_value;
-      if (delta < 0LL)
-         aixdisk_time[devIndex].curr_value = aixdisk_time[devIndex].last_value;
-      else
-         aixdisk_time[devIndex].curr_value = (double) delta / delta_t;
-      aixdisk_time[devIndex].last_value = aixdisk_time[devIndex].curr_value;
 
+static double
+derive_avg_serv( unsigned int i, double dt )
+{
+   if ((ctr_delta[CTR_RXFERS][i] < 0.0) || (ctr_delta[CTR_WXFERS][i] < 0.0)
+       || (ctr_delta[CTR_RSERV][i] < 0.0) || (ctr_delta[CTR_WSERV][i] < 0.0))
+      return( -1.0 );
 
-#ifdef _AIX53
-      delta = d.q_full - aixdisk_q_full[devIndex].last_total_value;
-      if (delta < 0LL)
-         aixdisk_q_full[devIndex].curr_value = aixdisk_q_full[devIndex].last_value;
-      else
-         aixdisk_q_full[devIndex].curr_value = delta;
-      aixdisk_q_full[devIndex].last_value = aixdisk_q_full[devIndex].curr_value;
+   return( (ctr_delta[CTR_RSERV][i] + ctr_delta[CTR_WSERV][i]) * tick2ms
+           / NONZERO( ctr_delta[CTR_XFERS][i] ) );
+}
 
 
-      delta = d.rserv - aixdisk_rserv[devIndex].last_total_value;
-      if (delta < 0LL)
-         aixdisk_rserv[devIndex].curr_value = aixdisk_rserv[devIndex].last_value;
-      else
-      {
-         dx2 = d.xrate - aixdisk_xrate[devIndex].last_total_value;
-         aixdisk_rserv[devIndex].curr_value = HWTICS2MSECS( delta ) / NONZERO( dx2 );
-      }
-      aixdisk_rserv[devIndex].last_value = aixdisk_rserv[devIndex].curr_value;
+/* Little's law: transfers in service = arrival rate * service time */
+static double
+derive_avg_sqsz( unsigned int i, double dt )
+{
+   if ((ctr_delta[CTR_RXFERS][i] < 0.0) || (ctr_delta[CTR_WXFERS][i] < 0.0))
+      return( -1.0 );
+
+   return( ctr_delta[CTR_XFERS][i] / dt * metric_values[M_AVG_SERV][i].curr_value / 1000.0 );
+}
 
 
-      aixdisk_rtimeout[devIndex].curr_value = d.rtimeout;
+/* invalid deltas are negative, so they never count as new errors */
+static double
+derive_new_errors( unsigned int i, double dt )
+{
+   return( ((ctr_delta[CTR_RTIMEOUT][i] > 0.0) || (ctr_delta[CTR_RFAILED][i] > 0.0)
+            || (ctr_delta[CTR_WTIMEOUT][i] > 0.0) || (ctr_delta[CTR_WFAILED][i] > 0.0)) ? 1.0 : 0.0 );
+}
 
 
-      aixdisk_rfailed[devIndex].curr_value = d.rfailed;
 
+/* Saturation score 0-100 from the busy percentage, the average wait queue
+   size (n waiting counts as n / (n + 1)) and the inflation of the average
+   service time over its baseline, updated from unsaturated intervals */
+static double
+derive_saturation( unsigned int i, double dt )
+{
+   double busy,
+          wqsz,
+          serv,
+          inflation;
 
-      aixdisk_min_rserv[devIndex].curr_value = HWTICS2MSECS( d.min_rserv );
 
+   if ((ctr_delta[CTR_XFERS][i] < 0.0) || (ctr_delta[CTR_WQ_SAMPLED][i] < 0.0))
+      return( -1.0 );
 
-      aixdisk_max_rserv[devIndex].curr_value = HWTICS2MSECS( d.max_rserv );
+   busy = metric_values[M_BUSY][i].curr_value;
+   wqsz = metric_values[M_AVG_WQSZ][i].curr_value;
+   serv = metric_values[M_AVG_SERV][i].curr_value;
 
+   inflation = 0.0;
 
-      delta = d.wserv - aixdisk_wserv[devIndex].last_total_value;
-      if (delta < 0LL)
-         aixdisk_wserv[devIndex].curr_value = aixdisk_wserv[devIndex].last_value;
-      else
+   if ((ctr_delta[CTR_XFERS][i] > 0.0) && (serv > 0.0))
+   {
+      if (serv_baseline[i] > 0.0)
       {
-         dx1 = d.xfers - aixdisk_xfers[devIndex].last_total_value;
-         dx2 = d.xrate - aixdisk_xrate[devIndex].last_total_value;
-         aixdisk_wserv[devIndex].curr_value = HWTICS2MSECS( delta ) / NONZERO( dx1 - dx2 );
+         inflation = (serv / serv_baseline[i] - 1.0) / (SAT_INFLATION - 1.0);
+         if (inflation < 0.0)
+            inflation = 0.0;
+         else if (inflation > 1.0)
+            inflation = 1.0;
       }
-      aixdisk_wserv[devIndex].last_value = aixdisk_q_full[devIndex].curr_value;
 
+      if (serv_baseline[i] == 0.0)
+         serv_baseline[i] = serv;
+      else if (busy < SAT_BASELINE_BUSY)
+         serv_baseline[i] += SAT_BASELINE_ALPHA * (serv - serv_baseline[i]);
+   }
 
-      aixdisk_wtimeout[devIndex].curr_value = d.wtimeout;
+   if (wqsz < 0.0)
+      wqsz = 0.0;
 
+   return( SAT_WEIGHT_BUSY * busy
+           + SAT_WEIGHT_QUEUE * 100.0 * wqsz / (wqsz + 1.0)
+           + SAT_WEIGHT_SERV * 100.0 * inflation );
+}
 
-      aixdisk_wfailed[devIndex].curr_value = d.wfailed;
 
 
-      aixdisk_min_wserv[devIndex].curr_value = HWTICS2MSECS( d.min_wserv );
+/* Definition of all per disk metrics.  Registration, computation and
+   serving of the values are driven by this table alone. */
+
+#define STATE_VALUE                  .kind = KIND_STATE
+#define STATIC_FIELD(f, s)           .kind = KIND_STATIC, .field = offsetof( perfstat_disk_t, f ), .scale = (s)
+#define GAUGE_FIELD(f, s, by)        .kind = KIND_GAUGE, .field = offsetof( perfstat_disk_t, f ), \
+                                     .scale = (s), .scale_by = (by)
+#define COUNTER_RATE(c, s, by)       .kind = KIND_RATE, .counter = (c), .scale = (s), .scale_by = (by)
+#define COUNTER_DELTA(c)             .kind = KIND_DELTA, .counter = (c), .scale = 1.0
+#define COUNTER_RATIO(c, p, s, by)   .kind = KIND_RATIO, .counter = (c), .per = (p), \
+                                     .scale = (s), .scale_by = (by)
+#define DERIVED_BY(f)                .kind = KIND_DERIVED, .derive = (f)
+#define PEAK_RATE(c, s, by)          .kind = KIND_PEAK, .counter = (c), .scale = (s), .scale_by = (by)
+
+#define MB (1024.0 * 1024.0)
+
+static const aixdisk_metric_def_t aixdisk_metric_defs[NUM_METRICS] = {
+   [M_SIZE] = { "size", "total disk size", "bytes",
+                STATIC_FIELD( size, MB ), .packed = 'm' },
+   [M_FREE] = { "free", "free disk size", "bytes",
+                GAUGE_FIELD( free, MB, SCALE_NONE ), .packed = 'm' },
+   [M_BSIZE] = { "bsize", "block size", "bytes",
+                 STATIC_FIELD( bsize, 1.0 ), .packed = 'u' },
+   [M_XRATE] = { "xrate", "transfer rate capability", "bytes/sec",
+                 STATIC_FIELD( xrate, 1024.0 ) },
+   [M_XFERS] = { "xfers", "number of transfers to/from disk", "transfers/sec",
+                 COUNTER_RATE( CTR_XFERS, 1.0, SCALE_NONE ) },
+   [M_WBYTES] = { "wbytes", "number of bytes written to disk", "bytes",
+                  COUNTER_RATE( CTR_WBLKS, 1.0, SCALE_BSIZE ) },
+   [M_RBYTES] = { "rbytes", "number of bytes read from disk", "bytes",
+                  COUNTER_RATE( CTR_RBLKS, 1.0, SCALE_BSIZE ) },
+   [M_QDEPTH] = { "qdepth", "instantaneous service queue depth", "",
+                  GAUGE_FIELD( qdepth, 1.0, SCALE_NONE ), .packed = 'u' },
+   [M_TIME] = { "time", "percentage of time disk is active", "",
+                COUNTER_RATE( CTR_TIME, 1.0, SCALE_NONE ) },
+   [M_HEALTH] = { "health", "disk health, 0 = ok, 1 = missing, 2 = disabled", "",
+                  STATE_VALUE, .packed = 'u' },
+   [M_FILL_RATE] = { "fill_rate", "free disk space consumed per hour", "bytes/hour",
+                     STATE_VALUE },
+   [M_TIME_TO_FULL] = { "time_to_full", "estimated time until no free disk space is left, -1 = not filling", "hours",
+                        STATE_VALUE },
+
+   [M_Q_FULL] = { "q_full", "service queue full occurrence count", "",
+                  COUNTER_DELTA( CTR_Q_FULL ), .packed = 'u' },
+   [M_RSERV] = { "rserv", "read or receive service time", "",
+                 COUNTER_RATIO( CTR_RSERV, CTR_RXFERS, 1.0, SCALE_TICKS ) },
+   [M_RTIMEOUT] = { "rtimeout", "number of read request timeouts", "",
+                    GAUGE_FIELD( rtimeout, 1.0, SCALE_NONE ), .packed = 'u' },
+   [M_RFAILED] = { "rfailed", "number of failed read requests", "",
+                   GAUGE_FIELD( rfailed, 1.0, SCALE_NONE ), .packed = 'u' },
+   [M_MIN_RSERV] = { "min_rserv", "minimum read or receive service time", "",
+                     GAUGE_FIELD( min_rserv, 1.0, SCALE_TICKS ) },
+   [M_MAX_RSERV] = { "max_rserv", "maximum read or receive service time", "",
+                     GAUGE_FIELD( max_rserv, 1.0, SCALE_TICKS ) },
+   [M_WSERV] = { "wserv", "write or send service time", "",
+                 COUNTER_RATIO( CTR_WSERV, CTR_WXFERS, 1.0, SCALE_TICKS ) },
+   [M_WTIMEOUT] = { "wtimeout", "number of write request timeouts", "",
+                    GAUGE_FIELD( wtimeout, 1.0, SCALE_NONE ), .packed = 'u' },
+   [M_WFAILED] = { "wfailed", "number of failed write requests", "",
+                   GAUGE_FIELD( wfailed, 1.0, SCALE_NONE ), .packed = 'u' },
+   [M_MIN_WSERV] = { "min_wserv", "minimum write or send service time", "",
+                     GAUGE_FIELD( min_wserv, 1.0, SCALE_TICKS ) },
+   [M_MAX_WSERV] = { "max_wserv", "maximum write or send service time", "",
+                     GAUGE_FIELD( max_wserv, 1.0, SCALE_TICKS ) },
+   [M_WQ_DEPTH] = { "wq_depth", "instantaneous wait queue depth", "",
+                    GAUGE_FIELD( wq_depth, 1.0, SCALE_NONE ), .packed = 'u' },
+   [M_WQ_SAMPLED] = { "wq_sampled", "accumulated sampled dk_wq_depth", "",
+                      COUNTER_RATE( CTR_WQ_SAMPLED, 0.01, SCALE_CPUS ) },
+   [M_WQ_TIME] = { "wq_time", "accumulated wait queueing time", "",
+                   DERIVED_BY( derive_wq_time ) },
+   [M_WQ_MIN_TIME] = { "wq_min_time", "minimum wait queueing time", "",
+                       GAUGE_FIELD( wq_min_time, 1.0, SCALE_TICKS ) },
+   [M_WQ_MAX_TIME] = { "wq_max_time", "maximum wait queueing time", "",
+                       GAUGE_FIELD( wq_max_time, 1.0, SCALE_TICKS ) },
+
+/* iostat -D style values */
+   [M_RPS] = { "rps", "number of read transfers", "transfers/sec",
+               COUNTER_RATE( CTR_RXFERS, 1.0, SCALE_NONE ) },
+   [M_WPS] = { "wps", "number of write transfers", "transfers/sec",
+               COUNTER_RATE( CTR_WXFERS, 1.0, SCALE_NONE ) },
+   [M_AVG_RSIZE] = { "avg_rsize", "average read transfer size", "bytes",
+                     COUNTER_RATIO( CTR_RBLKS, CTR_RXFERS, 1.0, SCALE_BSIZE ) },
+   [M_AVG_WSIZE] = { "avg_wsize", "average write transfer size", "bytes",
+                     COUNTER_RATIO( CTR_WBLKS, CTR_WXFERS, 1.0, SCALE_BSIZE ) },
+   [M_BUSY] = { "busy", "percentage of time disk is busy", "%",
+                DERIVED_BY( derive_busy ) },
+   [M_AVG_SERV] = { "avg_serv", "average service time per transfer", "ms",
+                    DERIVED_BY( derive_avg_serv ) },
+   [M_AVG_WQTIME] = { "avg_wqtime", "average wait queue time per transfer", "ms",
+                      COUNTER_RATIO( CTR_WQ_TIME, CTR_XFERS, 1.0, SCALE_TICKS ) },
+/* wait queue time accumulated per second (ms to s) is the time averaged
+   number of waiting transfers, unlike the sampled depth of wq_sampled */
+   [M_AVG_WQSZ] = { "avg_wqsz", "time averaged wait queue size", "",
+                    COUNTER_RATE( CTR_WQ_TIME, 0.001, SCALE_TICKS ) },
+   [M_AVG_SQSZ] = { "avg_sqsz", "average service queue size", "",
+                    DERIVED_BY( derive_avg_sqsz ) },
+
+/* error and queue full counters per interval and per second */
+   [M_RTIMEOUT_DELTA] = { "rtimeout_delta", "read request timeouts in the last interval", "timeouts",
+                          COUNTER_DELTA( CTR_RTIMEOUT ), .packed = 'u' },
+   [M_RTIMEOUT_RATE] = { "rtimeout_rate", "read request timeouts per second", "timeouts/sec",
+                         COUNTER_RATE( CTR_RTIMEOUT, 1.0, SCALE_NONE ) },
+   [M_RFAILED_DELTA] = { "rfailed_delta", "failed read requests in the last interval", "requests",
+                         COUNTER_DELTA( CTR_RFAILED ), .packed = 'u' },
+   [M_RFAILED_RATE] = { "rfailed_rate", "failed read requests per second", "requests/sec",
+                        COUNTER_RATE( CTR_RFAILED, 1.0, SCALE_NONE ) },
+   [M_WTIMEOUT_DELTA] = { "wtimeout_delta", "write request timeouts in the last interval", "timeouts",
+                          COUNTER_DELTA( CTR_WTIMEOUT ), .packed = 'u' },
+   [M_WTIMEOUT_RATE] = { "wtimeout_rate", "write request timeouts per second", "timeouts/sec",
+                         COUNTER_RATE( CTR_WTIMEOUT, 1.0, SCALE_NONE ) },
+   [M_WFAILED_DELTA] = { "wfailed_delta", "failed write requests in the last interval", "requests",
+                         COUNTER_DELTA( CTR_WFAILED ), .packed = 'u' },
+   [M_WFAILED_RATE] = { "wfailed_rate", "failed write requests per second", "requests/sec",
+                        COUNTER_RATE( CTR_WFAILED, 1.0, SCALE_NONE ) },
+   [M_Q_FULL_RATE] = { "q_full_rate", "service queue full occurrences per second", "occurrences/sec",
+                       COUNTER_RATE( CTR_Q_FULL, 1.0, SCALE_NONE ) },
+   [M_NEW_ERRORS] = { "new_errors", "new read or write errors in the last interval (0/1)", "",
+                      DERIVED_BY( derive_new_errors ), .packed = 'u' },
+   [M_SATURATION] = { "saturation", "saturation score from busy, wait queue and service time inflation", "%",
+                      DERIVED_BY( derive_saturation ) },
+
+/* highest rates seen by the peak sampler within the interval */
+   [M_XFERS_PEAK] = { "xfers_peak", "peak number of transfers to/from disk", "transfers/sec",
+                      PEAK_RATE( CTR_XFERS, 1.0, SCALE_NONE ) },
+   [M_RBYTES_PEAK] = { "rbytes_peak", "peak number of bytes read from disk", "bytes/sec",
+                       PEAK_RATE( CTR_RBLKS, 1.0, SCALE_BSIZE ) },
+   [M_WBYTES_PEAK] = { "wbytes_peak", "peak number of bytes written to disk", "bytes/sec",
+                       PEAK_RATE( CTR_WBLKS, 1.0, SCALE_BSIZE ) }
+};
 
+#undef STATE_VALUE
+#undef STATIC_FIELD
+#undef GAUGE_FIELD
+#undef COUNTER_RATE
+#undef COUNTER_DELTA
+#undef COUNTER_RATIO
+#undef DERIVED_BY
+#undef PEAK_RATE
+#undef MB
 
-      aixdisk_max_wserv[devIndex].curr_value = HWTICS2MSECS( d.max_wserv );
 
+/* scale of every metric including the factors which are the same for all
+   disks, refreshed every cycle */
+static double metric_factor[NUM_METRICS];
 
-      aixdisk_wq_depth[devIndex].curr_value = d.wq_depth;
+/* the registered field metrics, copied from every perfstat record */
+static unsigned int static_metric[NUM_METRICS];
+static unsigned int static_metric_count = 0;
+static unsigned int gauge_metric[NUM_METRICS];
+static unsigned int gauge_metric_count = 0;
 
+#define FIELD(d, off) (*(const u_longlong_t *) ((const char *) (d) + (off)))
 
-      delta = d.wq_sampled - aixdisk_wq_sampled[devIndex].last_total_value;
-      if (delta < 0LL)
-         aixdisk_wq_sampled[devIndex].curr_value = aixdisk_wq_sampled[devIndex].last_value;
-      else
-         aixdisk_wq_sampled[devIndex].curr_value = (double) delta / (100.0 * delta_t * nCPUs);
-      aixdisk_wq_sampled[devIndex].last_value = aixdisk_wq_sampled[devIndex].curr_value;
 
+static void
+update_factors( int nCPUs )
+{
+   unsigned int m;
+   double f;
 
-      delta = d.wq_time - aixdisk_wq_time[devIndex].last_total_value;
-      if (delta < 0LL)
-         aixdisk_wq_time[devIndex].curr_value = aixdisk_wq_time[devIndex].last_value;
-      else
-      {
-         dx1 = d.xfers - aixdisk_xfers[devIndex].last_total_value;
-         aixdisk_wq_time[devIndex].curr_value = HWTICS2MSECS( delta )
-                                                  / NONZERO( dx1 )
-                                                  / delta_t;
-      }
-      aixdisk_wq_time[devIndex].last_value = aixdisk_wq_time[devIndex].curr_value;
 
+   tick2ms = XINTFRAC / 1000000.0;
 
-      aixdisk_wq_min_time[devIndex].curr_value = HWTICS2MSECS( d.wq_min_time );
+   for (m = 0;  m < NUM_METRICS;  m++)
+   {
+      f = aixdisk_metric_defs[m].scale;
 
+      if (aixdisk_metric_defs[m].scale_by == SCALE_TICKS)
+         f *= tick2ms;
+      else if (aixdisk_metric_defs[m].scale_by == SCALE_CPUS)
+         f /= nCPUs;
 
-      aixdisk_wq_max_time[devIndex].curr_value = HWTICS2MSECS( d.wq_max_time );
-#endif
+      metric_factor[m] = f;
    }
+}
 
 
-/* save values for next call */
-   aixdisk_xfers[devIndex].last_total_value = d.xfers;
-   aixdisk_wbytes[devIndex].last_total_value = d.wblks;
-   aixdisk_rbytes[devIndex].last_total_value = d.rblks;
-   aixdisk_time[devIndex].last_total_value = d.time;
-#ifdef _AIX53
-   aixdisk_q_full[devIndex].last_total_value = d.q_full;
-   aixdisk_rserv[devIndex].last_total_value = d.rserv;
-   aixdisk_wserv[devIndex].last_total_value = d.wserv;
-   aixdisk_wq_sampled[devIndex].last_total_value = d.wq_sampled;
-   aixdisk_wq_time[devIndex].last_total_value = d.wq_time;
-#endif
 
+/* Compute all rates and derived values of this cycle, one metric at a time
+   over all disks, so every kind has a tight loop of its own.  The loops of
+   the rates, deltas, ratios and peaks have no branch and are left to the
+   vectorizer of the compiler, there is no hand written SIMD code. */
+static void
+compute_metrics( unsigned int n )
+{
+   const aixdisk_metric_def_t *def;
+   aixdisk_data_t *data;
+   const aixdisk_data_t *bsize;
+   const double *delta,
+                *per;
+   double *peak;
+   double f,
+          v;
+   unsigned int k,
+                m,
+                i,
+                j;
+
+
+   bsize = metric_values[M_BSIZE];
+
+   for (k = 0;  k < aixdisk_metric_count;  k++)
+   {
+      m = aixdisk_metric_id[k];
+      def = &aixdisk_metric_defs[m];
+      data = aixdisk_metric_data[k];
+      delta = ctr_delta[def->counter];
+      per = ctr_delta[def->per];
+      f = metric_factor[m];
+
+      switch (def->kind)
+      {
+         case KIND_RATE:
+            if (def->scale_by == SCALE_BSIZE)
+               for (i = 0;  i < n;  i++)
+               {
+                  UPDATE( data, delta[i] >= 0.0, delta[i] / disk_delta_t[i] * f * bsize[i].curr_value );
+               }
+            else
+               for (i = 0;  i < n;  i++)
+               {
+                  UPDATE( data, delta[i] >= 0.0, delta[i] / disk_delta_t[i] * f );
+               }
+            break;
+
+         case KIND_DELTA:
+            for (i = 0;  i < n;  i++)
+            {
+               UPDATE( data, delta[i] >= 0.0, delta[i] * f );
+            }
+            break;
 
-#ifdef DEBUG
-fprintf( stderr, "============== disk ( %s ) BEGIN ========================\n", 
-                 aixdisks[devIndex].devName );
-fprintf( stderr, "size        = %.0f\n", aixdisk_size[devIndex].curr_value );
-fprintf( stderr, "free        = %.0f\n", aixdisk_free[devIndex].curr_value );
-fprintf( stderr, "bsize       = %.0f\n", aixdisk_bsize[devIndex].curr_value );
-fprintf( stderr, "xrate       = %.3f\n", aixdisk_xrate[devIndex].curr_value );
-fprintf( stderr, "xfers       = %.3f\n", aixdisk_xfers[devIndex].curr_value );
-fprintf( stderr, "wbytes      = %.3f\n", aixdisk_wbytes[devIndex].curr_value );
-fprintf( stderr, "rbytes      = %.3f\n", aixdisk_rbytes[devIndex].curr_value );
-fprintf( stderr, "qdepth      = %.0f\n", aixdisk_qdepth[devIndex].curr_value );
-fprintf( stderr, "time        = %f\n", aixdisk_time[devIndex].curr_value );
-#ifdef _AIX53
-fprintf( stderr, "q_full      = %f\n", aixdisk_q_full[devIndex].curr_value );
-fprintf( stderr, "rserv       = %f\n", aixdisk_rserv[devIndex].curr_value );
-fprintf( stderr, "rtimeout    = %f\n", aixdisk_rtimeout[devIndex].curr_value );
-fprintf( stderr, "rfailed     = %f\n", aixdisk_rfailed[devIndex].curr_value );
-fprintf( stderr, "min_rserv   = %f\n", aixdisk_min_rserv[devIndex].curr_value );
-fprintf( stderr, "max_rserv   = %f\n", aixdisk_max_rserv[devIndex].curr_value );
-fprintf( stderr, "wserv       = %f\n", aixdisk_wserv[devIndex].curr_value );
-fprintf( stderr, "wtimeout    = %f\n", aixdisk_wtimeout[devIndex].curr_value );
-fprintf( stderr, "wfailed     = %f\n", aixdisk_wfailed[devIndex].curr_value );
-fprintf( stderr, "min_wserv   = %f\n", aixdisk_min_wserv[devIndex].curr_value );
-fprintf( stderr, "max_wserv   = %f\n", aixdisk_max_wserv[devIndex].curr_value );
-fprintf( stderr, "wq_depth    = %f\n", aixdisk_wq_depth[devIndex].curr_value );
-fprintf( stderr, "wq_sampled  = %f\n", aixdisk_wq_sampled[devIndex].curr_value );
-fprintf( stderr, "wq_time     = %f\n", aixdisk_wq_time[devIndex].curr_value );
-fprintf( stderr, "wq_min_time = %f\n", aixdisk_wq_min_time[devIndex].curr_value );
-fprintf( stderr, "wq_max_time = %f\n", aixdisk_wq_max_time[devIndex].curr_value );
-#endif
-fprintf( stderr, "============== disk ( %s ) END ========================\n",
-                 aixdisks[devIndex].devName );
-fprintf( stderr, "\n" );
-fflush( stderr );
-#endif
+         case KIND_RATIO:
+            if (def->scale_by == SCALE_BSIZE)
+               for (i = 0;  i < n;  i++)
+               {
+                  UPDATE( data, (delta[i] >= 0.0) && (per[i] >= 0.0),
+                          delta[i] * f * bsize[i].curr_value / NONZERO( per[i] ) );
+               }
+            else
+               for (i = 0;  i < n;  i++)
+               {
+                  UPDATE( data, (delta[i] >= 0.0) && (per[i] >= 0.0),
+                          delta[i] * f / NONZERO( per[i] ) );
+               }
+            break;
 
-   aixdisks[devIndex].last_read = now;
+         case KIND_DERIVED:
+            for (j = 0;  j < disk_active_count;  j++)
+            {
+               i = disk_active[j];
+               v = def->derive( i, disk_delta_t[i] );
+               UPDATE( data, v >= 0.0, v );
+            }
+            break;
+
+/* The interval average is a lower bound of the peak and stands in for it
+   if no sample fell into this cycle.  The samples are used up here. */
+         case KIND_PEAK:
+            pthread_mutex_lock( &peak_lock );
+            peak = peak_max[def->counter];
+            if (def->scale_by == SCALE_BSIZE)
+               for (i = 0;  i < n;  i++)
+               {
+                  v = delta[i] / disk_delta_t[i];
+                  v = (peak[i] > v) ? peak[i] : v;
+                  peak[i] = -1.0;
+                  UPDATE( data, v >= 0.0, v * f * bsize[i].curr_value );
+               }
+            else
+               for (i = 0;  i < n;  i++)
+               {
+                  v = delta[i] / disk_delta_t[i];
+                  v = (peak[i] > v) ? peak[i] : v;
+                  peak[i] = -1.0;
+                  UPDATE( data, v >= 0.0, v * f );
+               }
+            pthread_mutex_unlock( &peak_lock );
+            break;
+
+         default:
+            break;  /* fields are copied by store_disk(), the health is set by update_health() */
+      }
+   }
 }
 
 
 
-static double
-get_current_time( void )
+/* Flag every value which moved beyond the change epsilon.  The values of
+   quiet disks computed from the deltas are known to be unchanged. */
+static void
+mark_changed( void )
 {
-   struct timeval timeValue;
-   struct timezone timeZone;
+   unsigned int m,
+                i,
+                idx;
+   int from_deltas;
+   double curr,
+          prev,
+          diff;
 
 
-   gettimeofday( &timeValue, &timeZone );
+   if (aixdisk_dirty == NULL)
+      return;
 
-   return( (double) (timeValue.tv_sec - boottime) + (timeValue.tv_usec / 1000000.0) );
-}
+   for (m = 0;  m < aixdisk_metric_count;  m++)
+   {
+      from_deltas = KIND_FROM_DELTAS( aixdisk_metric_defs[aixdisk_metric_id[m]].kind );
 
+      for (i = 0;  i < aixdisk_count;  i++)
+      {
+         idx = m * aixdisk_count + i;
 
+         if (DIRTY_TEST( idx ) || (from_deltas && disk_quiet[i]))
+            continue;
 
-static double
-time_diff( int aixdisk_index, double *now )
-{
-   *now = get_current_time();
+         curr = aixdisk_metric_data[m][i].curr_value;
+         prev = aixdisk_published[idx];
+
+         diff = curr - prev;
+         if (diff < 0.0)
+            diff = -diff;
+         if (prev < 0.0)
+            prev = -prev;
 
-   return( *now - aixdisks[aixdisk_index].last_read );
+         if ((diff > change_epsilon * prev) || ((diff != 0.0) && (change_epsilon == 0.0)))
+            DIRTY_SET( idx );
+      }
+   }
 }
 
 
 
-static g_val_t
-aixdisk_size_func( int aixdisk_index )
+/* Copy the static disk properties of one perfstat record into the cache */
+static void
+store_disk_static( int devIndex, const perfstat_disk_t *d )
 {
-   double delta_t,
-          now;
-   g_val_t val;
+   unsigned int j,
+                m;
 
 
-   if (aixdisks[aixdisk_index].enabled)
+   for (j = 0;  j < static_metric_count;  j++)
    {
-      delta_t = time_diff( aixdisk_index, &now );
-
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
-
-      val.d = aixdisk_size[aixdisk_index].curr_value;
+      m = static_metric[j];
+      metric_values[m][devIndex].curr_value = FIELD( d, aixdisk_metric_defs[m].field ) * metric_factor[m];
    }
-   else
-      val.d = -1.0;
-
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_size_func = %f\n", val.d ); fflush( stderr );
-#endif
-
-
-   return( val );
 }
 
 
-static g_val_t
-aixdisk_free_func( int aixdisk_index )
+
+/* Copy the gauges and raw counters of one perfstat record into the
+   columnar per disk storage.  Without the extended statistics the loops
+   simply end before the extended fields. */
+static void
+store_disk( int devIndex, const perfstat_disk_t *d, double now )
 {
-   double delta_t,
-          now;
-   g_val_t val;
+   unsigned int j,
+                m,
+                c;
 
 
-   if (aixdisks[aixdisk_index].enabled)
+   for (j = 0;  j < gauge_metric_count;  j++)
    {
-      delta_t = time_diff( aixdisk_index, &now );
-
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
-
-      val.d = aixdisk_free[aixdisk_index].curr_value;
+      m = gauge_metric[j];
+      metric_values[m][devIndex].curr_value = FIELD( d, aixdisk_metric_defs[m].field ) * metric_factor[m];
    }
-   else
-      val.d = -1.0;
 
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_free_func = %f\n", val.d ); fflush( stderr );
-#endif
+   for (c = 0;  c < active_counters;  c++)
+      ctr_total[c][devIndex] = FIELD( d, counter_field[c] );
 
+   ctr_total[CTR_WXFERS][devIndex] -= d->xrate;
 
-   return( val );
+   disk_delta_t[devIndex] = now - aixdisks[devIndex].last_read;
+   aixdisks[devIndex].last_read = now;
 }
 
 
-static g_val_t
-aixdisk_bsize_func( int aixdisk_index )
+
+static int
+find_disk( const char *name, int hint )
 {
-   double delta_t,
-          now;
-   g_val_t val;
+   int i;
 
 
-   if (aixdisks[aixdisk_index].enabled)
-   {
-      delta_t = time_diff( aixdisk_index, &now );
+   if ((hint < aixdisk_count) && (strcmp( name, aixdisks[hint].devName ) == 0))
+      return( hint );
 
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
+   for (i = 0;  i < aixdisk_count;  i++)
+      if (strcmp( name, aixdisks[i].devName ) == 0)
+         return( i );
 
-      val.d = aixdisk_bsize[aixdisk_index].curr_value;
-   }
-   else
-      val.d = -1.0;
+   return( -1 );
+}
 
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_bsize_func = %f\n", val.d ); fflush( stderr );
-#endif
 
 
-   return( val );
+static double
+get_current_time( void )
+{
+   struct timeval timeValue;
+   struct timezone timeZone;
+
+
+   gettimeofday( &timeValue, &timeZone );
+
+   return( (double) (timeValue.tv_sec - boottime) + (timeValue.tv_usec / 1000000.0) );
 }
 
 
 
-static g_val_t
-aixdisk_xrate_func( int aixdisk_index )
+/* Time which only moves forward, unlike the time of day which may be set
+   back.  The state file keeps its times in it, they are only compared
+   within the same boot. */
+static double
+get_monotonic_time( void )
 {
-   double delta_t,
-          now;
-   g_val_t val;
+   struct timespec ts;
 
 
-   if (aixdisks[aixdisk_index].enabled)
-   {
-      delta_t = time_diff( aixdisk_index, &now );
+   clock_gettime( CLOCK_MONOTONIC, &ts );
 
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
+   return( (double) ts.tv_sec + (double) ts.tv_nsec / 1000000000.0 );
+}
 
-      val.d = aixdisk_xrate[aixdisk_index].curr_value;
-   }
-   else
-      val.d = -1.0;
 
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_xrate_func = %f\n", val.d ); fflush( stderr );
-#endif
+
+/* Fingerprint of the counter columns, so a state file written by a module
+   which kept other fields in them is not taken over even if the counter
+   count and version match */
+static unsigned int
+state_layout( void )
+{
+   unsigned int h = 2166136261U,
+                c;
 
 
-   return( val );
+   for (c = 0;  c < NUM_COUNTERS;  c++)
+      h = (h ^ (unsigned int) counter_field[c]) * 16777619U;
+
+   return( h );
 }
 
 
-static g_val_t
-aixdisk_xfers_func( int aixdisk_index )
+
+/* Copy the current counter baselines into the state file, the read times
+   as monotonic times */
+static void
+save_state( double now )
 {
-   double delta_t,
-          now;
-   g_val_t val;
+   aixdisk_state_disk_t *sd;
+   double mono;
+   int i,
+       c;
 
 
-   if (aixdisks[aixdisk_index].enabled)
-   {
-      delta_t = time_diff( aixdisk_index, &now );
+   if (state_map == NULL)
+      return;
 
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
+   sd = (aixdisk_state_disk_t *) (state_map + 1);
+   mono = get_monotonic_time();
 
-      val.d = aixdisk_xfers[aixdisk_index].curr_value;
-   }
-   else
-      val.d = -1.0;
+   for (i = 0;  i < aixdisk_count;  i++)
+   {
+      strcpy( sd[i].devName, aixdisks[i].devName );
+      sd[i].identity = aixdisks[i].identity;
 
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_xfers_func = %f\n", val.d ); fflush( stderr );
-#endif
+/* a read after now was before the time of day was set back */
+      if (aixdisks[i].last_read < now)
+         sd[i].last_read = mono - (now - aixdisks[i].last_read);
+      else
+         sd[i].last_read = mono;
 
+      for (c = 0;  c < NUM_COUNTERS;  c++)
+         sd[i].last_total[c] = ctr_last_total[c][i];
+   }
 
-   return( val );
+   state_map->magic = STATE_MAGIC;
+   state_map->version = STATE_VERSION;
+   state_map->disk_count = aixdisk_count;
+   state_map->counter_count = NUM_COUNTERS;
+   state_map->counter_layout = state_layout();
+   state_map->boottime = boottime;
+   state_map->saved = mono;
 }
 
 
-static g_val_t
-aixdisk_wbytes_func( int aixdisk_index )
-{
-   double delta_t,
-          now;
-   g_val_t val;
-
 
-   if (aixdisks[aixdisk_index].enabled)
+/* Map the state file and take over the baselines it holds if they were
+   saved during this boot for the same disks, at most STATE_MAX_AGE ago.
+   Returns the number of disks whose baselines were restored. */
+static int
+open_state( const char *path, double now )
+{
+   aixdisk_state_header_t old;
+   aixdisk_state_disk_t *saved;
+   struct stat st;
+   double mono,
+          age;
+   int i,
+       c,
+       devIndex,
+       restored;
+
+
+   state_fd = open( path, O_RDWR | O_CREAT, 0644 );
+   if (state_fd < 0)
    {
-      delta_t = time_diff( aixdisk_index, &now );
+      syslog( LOG_WARNING, "aixdisk: cannot open state file %s", path );
+      return( 0 );
+   }
+
+   restored = 0;
+   saved = NULL;
+   memset( &old, 0, sizeof( old ) );
+   mono = get_monotonic_time();
 
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
 
-      val.d = aixdisk_wbytes[aixdisk_index].curr_value;
+/* read the previous contents before the file is resized */
+   if ((fstat( state_fd, &st ) == 0) && (st.st_size >= (off_t) sizeof( old )))
+   {
+      if (read( state_fd, &old, sizeof( old ) ) != sizeof( old ))
+         old.magic = 0;
+
+/* a file of another version or counter layout is never taken over */
+      if ((old.magic == STATE_MAGIC)
+          && ((old.version != STATE_VERSION)
+              || (old.counter_count != NUM_COUNTERS)
+              || (old.counter_layout != state_layout())))
+      {
+         syslog( LOG_NOTICE, "aixdisk: state file %s has another layout, baselines not restored", path );
+      }
+      else if ((old.magic == STATE_MAGIC)
+               && (old.boottime == (long long) boottime)
+               && (old.saved <= mono)
+               && (mono - old.saved <= STATE_MAX_AGE)
+               && (st.st_size >= (off_t) (sizeof( old ) + old.disk_count * sizeof( aixdisk_state_disk_t ))))
+      {
+         saved = malloc( old.disk_count * sizeof( aixdisk_state_disk_t ) + 1 );
+         if ((saved != NULL) &&
+             (read( state_fd, saved, old.disk_count * sizeof( aixdisk_state_disk_t ) )
+                 != (ssize_t) (old.disk_count * sizeof( aixdisk_state_disk_t ))))
+         {
+            free( saved );
+            saved = NULL;
+         }
+      }
    }
-   else
-      val.d = -1.0;
 
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_wbytes_func = %f\n", val.d ); fflush( stderr );
-#endif
+   if (saved != NULL)
+   {
+      for (i = 0;  i < old.disk_count;  i++)
+      {
+         saved[i].devName[MAX_G_STRING_SIZE - 1] = '\0';
 
+/* a disk of the same name may be another one, and a read which would
+   lie in the future or too far back is not believed */
+         devIndex = find_disk( saved[i].devName, i );
+         if ((devIndex < 0) || (saved[i].identity != aixdisks[devIndex].identity))
+            continue;
 
-   return( val );
-}
+         age = mono - saved[i].last_read;
+         if ((age < 0.0) || (age > STATE_MAX_AGE))
+            continue;
 
+         aixdisks[devIndex].last_read = now - age;
+         for (c = 0;  c < NUM_COUNTERS;  c++)
+            ctr_last_total[c][devIndex] = saved[i].last_total[c];
 
-static g_val_t
-aixdisk_rbytes_func( int aixdisk_index )
-{
-   double delta_t,
-          now;
-   g_val_t val;
+         restored++;
+      }
+
+      free( saved );
+   }
 
 
-   if (aixdisks[aixdisk_index].enabled)
-   {
-      delta_t = time_diff( aixdisk_index, &now );
+/* (re)size the file for the current disks and map it */
+   state_size = sizeof( aixdisk_state_header_t ) + aixdisk_count * sizeof( aixdisk_state_disk_t );
 
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
+   if (ftruncate( state_fd, state_size ) == 0)
+      state_map = mmap( NULL, state_size, PROT_READ | PROT_WRITE, MAP_SHARED, state_fd, 0 );
 
-      val.d = aixdisk_rbytes[aixdisk_index].curr_value;
+   if ((state_map == NULL) || (state_map == MAP_FAILED))
+   {
+      syslog( LOG_WARNING, "aixdisk: cannot map state file %s", path );
+      state_map = NULL;
+      close( state_fd );
+      state_fd = -1;
+      return( restored );
    }
-   else
-      val.d = -1.0;
-
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_rbytes_func = %f\n", val.d ); fflush( stderr );
-#endif
 
+   memset( state_map, 0, state_size );
 
-   return( val );
+   return( restored );
 }
 
 
-static g_val_t
-aixdisk_qdepth_func( int aixdisk_index )
-{
-   double delta_t,
-          now;
-   g_val_t val;
 
+static void
+close_state( void )
+{
+   if (state_map == NULL)
+      return;
 
-   if (aixdisks[aixdisk_index].enabled)
-   {
-      delta_t = time_diff( aixdisk_index, &now );
+   save_state( get_current_time() );
 
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
+   msync( state_map, state_size, MS_SYNC );
+   munmap( state_map, state_size );
+   close( state_fd );
 
-      val.d = aixdisk_qdepth[aixdisk_index].curr_value;
-   }
-   else
-      val.d = -1.0;
+   state_map = NULL;
+   state_fd = -1;
+}
 
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_qdepth_func = %f\n", val.d ); fflush( stderr );
-#endif
 
 
-   return( val );
+/* Fill in the header of a snapshot ring of nslots snapshots of nmetrics
+   metrics over all disks */
+static void
+ring_layout( aixdisk_shm_header_t *h, unsigned int nslots, unsigned int nmetrics )
+{
+   memset( h, 0, sizeof( *h ) );
+   h->magic = AIXDISK_SHM_MAGIC;
+   h->version = AIXDISK_SHM_VERSION;
+   h->header_size = sizeof( aixdisk_shm_header_t );
+   h->slot_offset = (h->header_size + (aixdisk_count + nmetrics) * AIXDISK_SHM_NAME_SIZE + 7) & ~7;
+   h->slot_size = sizeof( aixdisk_shm_slot_t ) + aixdisk_count * nmetrics * sizeof( double );
+   h->nslots = nslots;
+   h->ndisks = aixdisk_count;
+   h->nmetrics = nmetrics;
+   h->writer_pid = getpid();
 }
 
 
-static g_val_t
-aixdisk_time_func( int aixdisk_index )
+
+/* Write the disk and metric name tables of a ring at base */
+static void
+ring_names( char *base, const aixdisk_shm_header_t *h, const unsigned int *metric )
 {
-   double delta_t,
-          now;
-   g_val_t val;
+   char *names;
+   unsigned int m;
+   int i;
 
 
-   if (aixdisks[aixdisk_index].enabled)
-   {
-      delta_t = time_diff( aixdisk_index, &now );
+   names = base + h->header_size;
+   for (i = 0;  i < aixdisk_count;  i++)
+      strncpy( names + i * AIXDISK_SHM_NAME_SIZE, aixdisks[i].devName, AIXDISK_SHM_NAME_SIZE - 1 );
+   for (m = 0;  m < h->nmetrics;  m++)
+      strncpy( names + (aixdisk_count + m) * AIXDISK_SHM_NAME_SIZE,
+               aixdisk_metric_name[metric[m]], AIXDISK_SHM_NAME_SIZE - 1 );
+}
 
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
 
-      val.d = aixdisk_time[aixdisk_index].curr_value;
-   }
-   else
-      val.d = -1.0;
 
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_time_func = %f\n", val.d ); fflush( stderr );
-#endif
+/* Clear a mapped ring and write its header and name tables, the magic
+   goes last so readers never see a half written header */
+static void
+ring_init( aixdisk_shm_header_t *map, size_t size, aixdisk_shm_header_t *h, const unsigned int *metric )
+{
+   memset( map, 0, size );
 
+   ring_names( (char *) map, h, metric );
 
-   return( val );
+   h->magic = 0;
+   memcpy( map, h, sizeof( *h ) );
+   AIXDISK_SHM_BARRIER();
+   map->magic = AIXDISK_SHM_MAGIC;
 }
 
 
-/* The following disk properties are only available with AIX 5.3 and higher */
-#ifdef _AIX53
 
-static g_val_t
-aixdisk_q_full_func( int aixdisk_index )
+/* Create the shared memory object for the snapshot ring */
+static void
+open_shm( const char *name )
 {
-   double delta_t,
-          now;
-   g_val_t val;
+   aixdisk_shm_header_t h;
+   unsigned int m;
+   int fd;
 
 
-   if (aixdisks[aixdisk_index].enabled)
-   {
-      delta_t = time_diff( aixdisk_index, &now );
+   for (m = 0;  m < aixdisk_metric_count;  m++)
+      shm_metric[m] = m;
+
+   ring_layout( &h, shm_slots, aixdisk_metric_count );
 
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
+   shm_size = h.slot_offset + (size_t) h.nslots * h.slot_size;
 
-      val.d = aixdisk_q_full[aixdisk_index].curr_value;
+/* a left over object of an earlier run may have a different layout */
+   shm_unlink( name );
+
+   fd = shm_open( name, O_RDWR | O_CREAT | O_EXCL, 0644 );
+   if (fd < 0)
+   {
+      syslog( LOG_WARNING, "aixdisk: cannot create shared memory %s", name );
+      return;
    }
-   else
-      val.d = -1.0;
 
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_q_full_func = %f\n", val.d ); fflush( stderr );
-#endif
+   if (ftruncate( fd, shm_size ) == 0)
+      shm_map = mmap( NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
 
+   close( fd );
 
-   return( val );
+   if ((shm_map == NULL) || (shm_map == MAP_FAILED))
+   {
+      syslog( LOG_WARNING, "aixdisk: cannot map shared memory %s", name );
+      shm_map = NULL;
+      shm_unlink( name );
+      return;
+   }
+
+   ring_init( shm_map, shm_size, &h, shm_metric );
 }
 
 
-static g_val_t
-aixdisk_rserv_func( int aixdisk_index )
-{
-   double delta_t,
-          now;
-   g_val_t val;
 
+/* Map the history file, continuing the ring it holds if it was written
+   for the same disks, metrics and number of slots */
+static void
+open_history( const char *path )
+{
+   aixdisk_shm_header_t h;
+   char *names;
+   struct stat st;
+   int fd,
+       keep;
 
-   if (aixdisks[aixdisk_index].enabled)
-   {
-      delta_t = time_diff( aixdisk_index, &now );
 
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
+   ring_layout( &h, history_slots, history_metric_count );
 
-      val.d = aixdisk_rserv[aixdisk_index].curr_value;
-   }
-   else
-      val.d = -1.0;
+   history_size = h.slot_offset + (size_t) h.nslots * h.slot_size;
 
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_rserv_func = %f\n", val.d ); fflush( stderr );
-#endif
+   names = calloc( 1, h.slot_offset );
+   if (names == NULL)
+      return;
 
+   ring_names( names, &h, history_metric );
 
-   return( val );
-}
+   fd = open( path, O_RDWR | O_CREAT, 0644 );
+   if (fd < 0)
+   {
+      syslog( LOG_WARNING, "aixdisk: cannot open history file %s", path );
+      free( names );
+      return;
+   }
 
+   keep = (fstat( fd, &st ) == 0) && (st.st_size == (off_t) history_size);
 
-static g_val_t
-aixdisk_rtimeout_func( int aixdisk_index )
-{
-   double delta_t,
-          now;
-   g_val_t val;
+   if (keep || (ftruncate( fd, history_size ) == 0))
+      history_map = mmap( NULL, history_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
 
+   close( fd );
 
-   if (aixdisks[aixdisk_index].enabled)
+   if ((history_map == NULL) || (history_map == MAP_FAILED))
    {
-      delta_t = time_diff( aixdisk_index, &now );
-
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
-
-      val.d = aixdisk_rtimeout[aixdisk_index].curr_value;
+      syslog( LOG_WARNING, "aixdisk: cannot map history file %s", path );
+      history_map = NULL;
+      free( names );
+      return;
    }
-   else
-      val.d = -1.0;
-
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_rtimeout_func = %f\n", val.d ); fflush( stderr );
-#endif
 
+   keep = keep
+          && (history_map->magic == h.magic)
+          && (history_map->version == h.version)
+          && (history_map->header_size == h.header_size)
+          && (history_map->slot_offset == h.slot_offset)
+          && (history_map->slot_size == h.slot_size)
+          && (history_map->nslots == h.nslots)
+          && (history_map->ndisks == h.ndisks)
+          && (history_map->nmetrics == h.nmetrics)
+          && (memcmp( (char *) history_map + h.header_size, names + h.header_size,
+                      h.slot_offset - h.header_size ) == 0);
+
+   if (keep)
+      history_map->writer_pid = h.writer_pid;
+   else
+   {
+      syslog( LOG_INFO, "aixdisk: starting a new history in %s", path );
+      ring_init( history_map, history_size, &h, history_metric );
+   }
 
-   return( val );
+   free( names );
 }
 
 
-static g_val_t
-aixdisk_rfailed_func( int aixdisk_index )
+
+/* Publish the given metrics of this cycle into the next slot of a ring */
+static void
+publish_ring( aixdisk_shm_header_t *map, const unsigned int *metric, double now )
 {
-   double delta_t,
-          now;
-   g_val_t val;
+   aixdisk_shm_slot_t *slot;
+   double *values;
+   unsigned long long seq;
+   unsigned int m,
+                i;
 
 
-   if (aixdisks[aixdisk_index].enabled)
-   {
-      delta_t = time_diff( aixdisk_index, &now );
+   seq = map->seq + 1;
+   slot = (aixdisk_shm_slot_t *) ((char *) map + map->slot_offset
+                                  + (seq % map->nslots) * map->slot_size);
 
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
+   slot->seq = 2 * seq - 1;
+   AIXDISK_SHM_BARRIER();
 
-      val.d = aixdisk_rfailed[aixdisk_index].curr_value;
-   }
-   else
-      val.d = -1.0;
+   slot->time = now + boottime;
 
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_rfailed_func = %f\n", val.d ); fflush( stderr );
-#endif
+   values = (double *) (slot + 1);
+   for (m = 0;  m < map->nmetrics;  m++)
+      for (i = 0;  i < aixdisk_count;  i++)
+         values[m * aixdisk_count + i] = aixdisk_metric_data[metric[m]][i].curr_value;
 
+   AIXDISK_SHM_BARRIER();
+   slot->seq = 2 * seq;
 
-   return( val );
+   AIXDISK_SHM_BARRIER();
+   map->seq = seq;
 }
 
 
-static g_val_t
-aixdisk_min_rserv_func( int aixdisk_index )
+
+static void
+close_shm( void )
 {
-   double delta_t,
-          now;
-   g_val_t val;
+   if (shm_map == NULL)
+      return;
 
+   munmap( shm_map, shm_size );
+   shm_unlink( shm_name );
 
-   if (aixdisks[aixdisk_index].enabled)
-   {
-      delta_t = time_diff( aixdisk_index, &now );
+   shm_map = NULL;
+}
 
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
 
-      val.d = aixdisk_min_rserv[aixdisk_index].curr_value;
-   }
-   else
-      val.d = -1.0;
 
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_min_rserv_func = %f\n", val.d ); fflush( stderr );
-#endif
+/* The history file stays for the next run */
+static void
+close_history( void )
+{
+   if (history_map == NULL)
+      return;
 
+   msync( history_map, history_size, MS_SYNC );
+   munmap( history_map, history_size );
 
-   return( val );
+   history_map = NULL;
 }
 
 
-static g_val_t
-aixdisk_max_rserv_func( int aixdisk_index )
+
+/* Evaluate all SLO rules against this cycle's values in one pass over the
+   disks, logging every transition if asked to */
+static void
+check_slo( void )
 {
-   double delta_t,
-          now;
-   g_val_t val;
+   unsigned int i,
+                breaches;
+   unsigned char state;
+   double v;
+   size_t len,
+          name_len;
+   int r;
+
 
+   breaches = 0;
+   len = 0;
+   slo_list[0] = '\0';
 
-   if (aixdisks[aixdisk_index].enabled)
+   for (i = 0;  i < aixdisk_count;  i++)
    {
-      delta_t = time_diff( aixdisk_index, &now );
+/* missing and disabled disks only have stale values, they leave breach */
+      if (metric_values[M_HEALTH][i].curr_value != HEALTH_OK)
+      {
+         if ((slo_state[i] != 0) && slo_syslog)
+            syslog( LOG_NOTICE, "aixdisk: %s not reported, SLO breach cleared", aixdisks[i].devName );
 
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
+         slo_state[i] = 0;
+         continue;
+      }
 
-      val.d = aixdisk_max_rserv[aixdisk_index].curr_value;
-   }
-   else
-      val.d = -1.0;
+      state = slo_state[i];
 
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_max_rserv_func = %f\n", val.d ); fflush( stderr );
+      for (r = 0;  r < slo_count;  r++)
+      {
+         v = aixdisk_metric_data[slo_rules[r].metric][i].curr_value;
+
+         if ((v > slo_rules[r].threshold) && ! (state & (1 << r)))
+         {
+            state |= (unsigned char) (1 << r);
+            if (slo_syslog)
+               syslog( LOG_WARNING, "aixdisk: %s %s %.3f above SLO threshold %.3f",
+                       aixdisks[i].devName, aixdisk_metric_name[slo_rules[r].metric],
+                       v, slo_rules[r].threshold );
+         }
+         else if ((v < slo_rules[r].clear) && (state & (1 << r)))
+         {
+            state &= (unsigned char) ~(1 << r);
+            if (slo_syslog)
+               syslog( LOG_NOTICE, "aixdisk: %s %s %.3f back within SLO threshold %.3f",
+                       aixdisks[i].devName, aixdisk_metric_name[slo_rules[r].metric],
+                       v, slo_rules[r].threshold );
+         }
+      }
+
+      slo_state[i] = state;
+
+      if (state == 0)
+         continue;
+
+/* the list holds as many disks as fit into a string value */
+      breaches++;
+      name_len = strlen( aixdisks[i].devName );
+      if (len + name_len + 2 <= MAX_G_STRING_SIZE)
+      {
+         if (len > 0)
+            slo_list[len++] = ',';
+         memcpy( slo_list + len, aixdisks[i].devName, name_len + 1 );
+         len += name_len;
+      }
+   }
+
+   slo_breaches = breaches;
+}
+
+
+
+/* Add the values of disk i to the rollups of group g: summed transfers
+   and throughput and the highest busy percentage */
+static void
+group_add_basic( aixdisk_group_t *g, int i )
+{
+   double busy;
+
+
+   busy = metric_values[M_TIME][i].curr_value;
+
+   g->value[GRP_XFERS] += metric_values[M_XFERS][i].curr_value;
+   g->value[GRP_RBYTES] += metric_values[M_RBYTES][i].curr_value;
+   g->value[GRP_WBYTES] += metric_values[M_WBYTES][i].curr_value;
+   if (busy > g->value[GRP_BUSY])
+      g->value[GRP_BUSY] = busy;
+}
+
+
+
+/* The same with the extended statistics, plus the service time weighted
+   by transfers */
+static void
+group_add_extended( aixdisk_group_t *g, int i )
+{
+   group_add_basic( g, i );
+
+   g->value[GRP_AVG_SERV] += metric_values[M_AVG_SERV][i].curr_value * metric_values[M_XFERS][i].curr_value;
+}
+
+
+
+/* one of the above, bound by init_groups() to the level of the statistics */
+static void (*group_add)( aixdisk_group_t *g, int i ) = group_add_basic;
+
+
+
+/* Roll the values of this cycle up into the disk groups */
+static void
+compute_groups( void )
+{
+   aixdisk_group_t *g;
+   int n,
+       k,
+       i;
+
+
+   for (n = 0;  n < group_count;  n++)
+   {
+      g = &disk_groups[n];
+
+      memset( g->value, 0, sizeof( g->value ) );
+
+/* missing and disabled disks only have stale values, they are left out */
+      for (k = 0;  k < g->count;  k++)
+      {
+         i = g->members[k];
+         if (metric_values[M_HEALTH][i].curr_value != HEALTH_OK)
+            continue;
+
+         group_add( g, i );
+      }
+
+      if (g->value[GRP_BUSY] > 100.0)
+         g->value[GRP_BUSY] = 100.0;
+      if (g->value[GRP_XFERS] > 0.0)
+         g->value[GRP_AVG_SERV] /= g->value[GRP_XFERS];
+   }
+}
+
+
+
+/* Highest saturation score of this cycle over the enabled disks */
+static void
+compute_saturation_max( void )
+{
+   const aixdisk_data_t *saturation;
+   double max;
+   int i;
+
+
+   saturation = metric_values[M_SATURATION];
+   max = 0.0;
+
+   for (i = 0;  i < aixdisk_count;  i++)
+      if (aixdisks[i].enabled && (saturation[i].curr_value > max))
+         max = saturation[i].curr_value;
+
+   saturation_max = max;
+}
+
+
+
+/* Render the current snapshot in OpenMetrics text format into http_buf,
+   growing it only if it is too small.  Returns the length of the text. */
+static size_t
+render_openmetrics( void )
+{
+   unsigned int m,
+                i;
+   size_t len,
+          room;
+   double v;
+   int n;
+
+
+   for (;;)
+   {
+      len = 0;
+
+/* once the buffer is full the rest is only measured */
+#define HTTP_APPEND(...) \
+   do { \
+      room = (len < http_buf_size) ? http_buf_size - len : 0; \
+      n = snprintf( (room > 0) ? http_buf + len : NULL, room, __VA_ARGS__ ); \
+      len += (n > 0) ? n : 0; \
+   } while (0)
+
+      pthread_mutex_lock( &snapshot_lock );
+
+      for (m = 0;  m < aixdisk_metric_count;  m++)
+      {
+         HTTP_APPEND( "# TYPE aixdisk_%s gauge\n# HELP aixdisk_%s %s\n",
+                      aixdisk_metric_name[m], aixdisk_metric_name[m], aixdisk_metric_desc[m] );
+
+         for (i = 0;  i < aixdisk_count;  i++)
+         {
+            v = aixdisk_metric_data[m][i].curr_value;
+
+/* the spelling of the special values is fixed by OpenMetrics, not libc */
+            if (isnan( v ) || isinf( v ))
+               HTTP_APPEND( "aixdisk_%s{disk=\"%s\"} %s\n", aixdisk_metric_name[m], aixdisks[i].devName,
+                            isnan( v ) ? "NaN" : ((v > 0.0) ? "+Inf" : "-Inf") );
+            else
+               HTTP_APPEND( "aixdisk_%s{disk=\"%s\"} %.17g\n", aixdisk_metric_name[m],
+                            aixdisks[i].devName, v );
+         }
+      }
+
+      HTTP_APPEND( "# TYPE aixdisk_snapshot_timestamp_seconds gauge\n"
+                   "aixdisk_snapshot_timestamp_seconds %.3f\n# EOF\n",
+                   snapshot_time + boottime );
+
+      pthread_mutex_unlock( &snapshot_lock );
+
+#undef HTTP_APPEND
+
+      if (len < http_buf_size)
+         return( len );
+
+/* the values got longer than ever before, retry with more room */
+      free( http_buf );
+      http_buf_size = 2 * len;
+      http_buf = malloc( http_buf_size );
+      if (http_buf == NULL)
+      {
+         http_buf_size = 0;
+         return( 0 );
+      }
+   }
+}
+
+
+
+/* write all of buf, giving up if the client does not take it */
+static int
+http_write( int fd, const char *buf, size_t len )
+{
+   ssize_t n;
+
+
+   while (len > 0)
+   {
+      n = write( fd, buf, len );
+      if (n <= 0)
+      {
+         if ((n < 0) && (errno == EINTR))
+            continue;
+         return( -1 );
+      }
+
+      buf += n;
+      len -= n;
+   }
+
+   return( 0 );
+}
+
+
+
+/* Answer one request, anything but a GET is refused */
+static void
+http_serve( int fd )
+{
+   char req[MAX_BUF_SIZE],
+        hdr[256];
+   size_t body_len;
+   ssize_t n;
+   int hdr_len;
+
+
+   n = read( fd, req, sizeof( req ) - 1 );
+   if (n <= 0)
+      return;
+   req[n] = '\0';
+
+   if (strncmp( req, "GET ", 4 ) != 0)
+   {
+      hdr_len = snprintf( hdr, sizeof( hdr ),
+                          "HTTP/1.0 405 Method Not Allowed\r\nContent-Length: 0\r\n\r\n" );
+      http_write( fd, hdr, hdr_len );
+      return;
+   }
+
+   body_len = render_openmetrics();
+
+   hdr_len = snprintf( hdr, sizeof( hdr ),
+                       "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nContent-Length: %lu\r\n\r\n",
+                       HTTP_CONTENT_TYPE, (unsigned long) body_len );
+
+   if (http_write( fd, hdr, hdr_len ) == 0)
+      http_write( fd, http_buf, body_len );
+}
+
+
+
+/* Serve scrapes one at a time.  This thread never collects, it only
+   renders what the gmond callbacks collected last. */
+static void *
+http_loop( void *arg )
+{
+   struct pollfd pfd;
+   struct timeval tv;
+   int fd;
+
+
+   tv.tv_sec = HTTP_TIMEOUT / 1000;
+   tv.tv_usec = (HTTP_TIMEOUT % 1000) * 1000;
+
+   while (! http_stop)
+   {
+      pfd.fd = http_fd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+
+      if (poll( &pfd, 1, HTTP_TIMEOUT ) <= 0)
+         continue;
+
+      fd = accept( http_fd, NULL, NULL );
+      if (fd < 0)
+         continue;
+
+/* a stuck client must not block the next scrape for long */
+      setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof( tv ) );
+      setsockopt( fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof( tv ) );
+
+      http_serve( fd );
+      close( fd );
+   }
+
+   return( NULL );
+}
+
+
+
+static void
+open_http( const char *address, int port )
+{
+   struct sockaddr_in sa;
+   int on;
+
+
+   memset( &sa, 0, sizeof( sa ) );
+   sa.sin_family = AF_INET;
+   sa.sin_port = htons( port );
+   if (inet_pton( AF_INET, address, &sa.sin_addr ) != 1)
+   {
+      syslog( LOG_WARNING, "aixdisk: invalid http_address %s", address );
+      return;
+   }
+
+   http_fd = socket( AF_INET, SOCK_STREAM, 0 );
+   if (http_fd < 0)
+      return;
+
+   on = 1;
+   setsockopt( http_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof( on ) );
+
+   if ((bind( http_fd, (struct sockaddr *) &sa, sizeof( sa ) ) != 0)
+       || (listen( http_fd, 8 ) != 0))
+   {
+      syslog( LOG_WARNING, "aixdisk: cannot listen on %s:%d", address, port );
+      close( http_fd );
+      http_fd = -1;
+      return;
+   }
+
+/* size the buffer for the first scrape, it grows if it has to */
+   http_buf_size = 128 * aixdisk_metric_count * (aixdisk_count + 2) + 256;
+   http_buf = malloc( http_buf_size );
+
+   http_stop = FALSE;
+   if ((http_buf == NULL) || (pthread_create( &http_thread, NULL, http_loop, NULL ) != 0))
+   {
+      syslog( LOG_WARNING, "aixdisk: cannot start the http endpoint" );
+      close( http_fd );
+      http_fd = -1;
+   }
+}
+
+
+
+static void
+close_http( void )
+{
+   if (http_fd < 0)
+      return;
+
+   http_stop = TRUE;
+   pthread_join( http_thread, NULL );
+
+   close( http_fd );
+   http_fd = -1;
+
+   free( http_buf );
+   http_buf = NULL;
+   http_buf_size = 0;
+}
+
+
+
+/* Make room for n records in the snapshot buffer *buffer of *capacity
+   records.  Returns FALSE if there is no memory for them. */
+static int
+grow_stats( perfstat_disk_t **buffer, int *capacity, int n )
+{
+   perfstat_disk_t *p;
+   int size;
+
+
+   if (n <= *capacity)
+      return( TRUE );
+
+   size = (*capacity > 0) ? *capacity : 1;
+   while (size < n)
+      size *= 2;
+
+   p = realloc( *buffer, (size_t) size * disk_stat_size );
+   if (p == NULL)
+      return( FALSE );
+
+   *buffer = p;
+   *capacity = size;
+
+   return( TRUE );
+}
+
+
+
+/* Read n disks from aixdisks[first] on one by one into *buffer from
+   record offset on.  Returns the number of records read. */
+static int
+fetch_each( perfstat_disk_t **buffer, int *capacity, int first, int n, int offset )
+{
+   perfstat_id_t id;
+   int i,
+       count;
+
+
+   if (! grow_stats( buffer, capacity, offset + n ))
+      return( 0 );
+
+   count = 0;
+
+   for (i = first;  i < first + n;  i++)
+   {
+      strcpy( id.name, aixdisks[i].devName );
+      if (perfstat_disk( &id, STAT_RECORD( *buffer, offset + count ), disk_stat_size, 1 ) == 1)
+         count++;
+   }
+
+   return( count );
+}
+
+
+
+/* Read the disks from aixdisks[first] up to the known disk aixdisks[stop]
+   with the name cursor into *buffer from record offset on.  The range
+   ends at a name, not after a number of records: disks added since the
+   init are read along with the known ones instead of pushing the last
+   of them out of the range.  Returns the number of records read. */
+static int
+fetch_range( perfstat_disk_t **buffer, int *capacity, int offset, int first, int stop )
+{
+   perfstat_id_t id;
+   int count,
+       next,
+       want,
+       got,
+       i,
+       devIndex;
+
+
+   strcpy( id.name, (first == 0) ? FIRST_DISK : aixdisks[first].devName );
+   count = 0;
+   next = first;
+
+   for (;;)
+   {
+/* disks added at the end of the list are read in small batches */
+      want = (next < stop) ? stop - next : RANGE_SLACK;
+
+      if (! grow_stats( buffer, capacity, offset + count + want ))
+         return( count );
+
+      got = perfstat_disk( &id, STAT_RECORD( *buffer, offset + count ), disk_stat_size, want );
+
+/* the cursor disk is gone, look at the rest of the range one by one */
+      if (got < 0)
+      {
+         if (strcmp( id.name, FIRST_DISK ) == 0)
+            return( count );
+
+         return( count + fetch_each( buffer, capacity, next, stop - next, offset + count ) );
+      }
+
+      for (i = 0;  i < got;  i++)
+      {
+         devIndex = find_disk( STAT_RECORD( *buffer, offset + count )->name, next );
+
+/* the next range starts here */
+         if (devIndex >= stop)
+            return( count );
+
+         if (devIndex >= 0)
+            next = devIndex + 1;
+
+         count++;
+      }
+
+      if ((got < want) || (strcmp( id.name, FIRST_DISK ) == 0)
+          || ((stop < aixdisk_count) && (strcmp( id.name, aixdisks[stop].devName ) == 0)))
+         return( count );
+   }
+}
+
+
+
+/* Take a snapshot of the next collect_budget disks of the rotation and of
+   the hot disks into disk_stats.  Returns the number of records in it. */
+static int
+fetch_slice( void )
+{
+   int count,
+       first,
+       n,
+       got,
+       h,
+       i;
+
+
+   memset( disk_due, FALSE, aixdisk_count );
+   count = 0;
+
+/* the slice is read with the name cursor, in two ranges if it wraps,
+   each up to the first disk after it */
+   for (n = collect_budget;  n > 0;  n -= got)
+   {
+      first = rotate_next;
+      got = (n < aixdisk_count - first) ? n : aixdisk_count - first;
+
+      memset( disk_due + first, TRUE, got );
+      rotate_next = (first + got) % aixdisk_count;
+
+      count += fetch_range( &disk_stats, &disk_stats_capacity, count, first, first + got );
+   }
+
+   for (h = 0;  h < hot_disk_used;  h++)
+   {
+      i = hot_disks[h];
+      if (disk_due[i])
+         continue;
+
+      disk_due[i] = TRUE;
+      count += fetch_each( &disk_stats, &disk_stats_capacity, i, 1, count );
+   }
+
+   return( count );
+}
+
+
+
+/* Count a detached thread about to be started */
+static void
+thread_started( void )
+{
+   pthread_mutex_lock( &thread_lock );
+   threads_running++;
+   pthread_mutex_unlock( &thread_lock );
+}
+
+
+
+/* Called by a detached thread as the last thing before it returns */
+static void
+thread_stopped( void )
+{
+   pthread_mutex_lock( &thread_lock );
+   if (--threads_running == 0)
+      pthread_cond_broadcast( &thread_exit );
+   pthread_mutex_unlock( &thread_lock );
+}
+
+
+
+/* Wait at most seconds for the detached threads which were told to stop.
+   Returns the number of threads still running, stuck in a perfstat call. */
+static int
+wait_threads( double seconds )
+{
+   struct timespec until;
+   int running;
+
+
+   clock_gettime( CLOCK_REALTIME, &until );
+   until.tv_sec += (time_t) seconds;
+   until.tv_nsec += (long) ((seconds - (time_t) seconds) * 1000000000.0);
+   if (until.tv_nsec >= 1000000000L)
+   {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000L;
+   }
+
+   pthread_mutex_lock( &thread_lock );
+
+   while ((threads_running > 0)
+          && (pthread_cond_timedwait( &thread_exit, &thread_lock, &until ) != ETIMEDOUT))
+      ;
+
+   running = threads_running;
+   pthread_mutex_unlock( &thread_lock );
+
+   return( running );
+}
+
+
+
+/* Read the range of disks of one worker into its buffer.  The range ends
+   at the first disk of the next worker, wherever it is in the list. */
+static int
+fetch_chunk( int w )
+{
+   return( fetch_range( &chunk_stats[w], &chunk_capacity[w], 0, chunk_first[w], chunk_first[w + 1] ) );
+}
+
+
+
+static void *
+worker_loop( void *arg )
+{
+   int w = (int) (long) arg,
+       count;
+   unsigned int round = 0;
+
+
+   pthread_mutex_lock( &worker_lock );
+
+   while (! worker_stop)
+   {
+      if (round == worker_round)
+      {
+         pthread_cond_wait( &worker_start, &worker_lock );
+         continue;
+      }
+
+      round = worker_round;
+      pthread_mutex_unlock( &worker_lock );
+
+      TRACE_SPAN( "snapshot_chunk", count, count = fetch_chunk( w ) );
+
+      pthread_mutex_lock( &worker_lock );
+
+      chunk_count[w] = count;
+      if (--worker_pending == 0)
+         pthread_cond_signal( &worker_done );
+   }
+
+   pthread_mutex_unlock( &worker_lock );
+
+   thread_stopped();
+
+   return( NULL );
+}
+
+
+
+/* Let the workers read their ranges and append them to disk_stats.
+   Returns the number of records. */
+static int
+fetch_parallel( void )
+{
+   int count,
+       w;
+
+
+   pthread_mutex_lock( &worker_lock );
+
+   worker_round++;
+   worker_pending = collect_workers;
+   pthread_cond_broadcast( &worker_start );
+
+   while (worker_pending > 0)
+      pthread_cond_wait( &worker_done, &worker_lock );
+
+   pthread_mutex_unlock( &worker_lock );
+
+   count = 0;
+
+   for (w = 0;  w < collect_workers;  w++)
+   {
+      if (! grow_stats( &disk_stats, &disk_stats_capacity, count + chunk_count[w] ))
+         break;
+
+      memcpy( DISK_STAT( count ), chunk_stats[w], (size_t) chunk_count[w] * disk_stat_size );
+      count += chunk_count[w];
+   }
+
+   return( count );
+}
+
+
+
+/* Take one snapshot of all disks with a single perfstat_disk() call, or
+   of the disks due in incremental mode, into disk_stats.  Returns the
+   number of disks in it. */
+static int
+fetch_disks( int *nCPUs )
+{
+
+
+/* get the number of CPUs */
+   *nCPUs = perfstat_cpu( NULL, NULL, sizeof( perfstat_cpu_t ), 0 );
+   if (*nCPUs < 1)
+      *nCPUs = 1;
+
+   if (collect_budget > 0)
+      return( fetch_slice() );
+
+   memset( disk_due, TRUE, aixdisk_count );
+
+   if (collect_workers > 1)
+      return( fetch_parallel() );
+
+
+/* ask to get all the structures available in one call, and more if
+   disks were added */
+   return( fetch_range( &disk_stats, &disk_stats_capacity, 0, 0, aixdisk_count ) );
+}
+
+
+
+/* Remember the most active disks, which are read every cycle in
+   incremental mode.  Their rates are at most one rotation old. */
+static void
+select_hot_disks( void )
+{
+   const aixdisk_data_t *xfers;
+   int i,
+       h;
+
+
+   xfers = metric_values[M_XFERS];
+   hot_disk_used = 0;
+
+   for (i = 0;  i < aixdisk_count;  i++)
+   {
+      if ((! aixdisks[i].enabled) || (xfers[i].curr_value <= 0.0)
+          || ((hot_disk_used == hot_disk_count)
+              && (xfers[i].curr_value <= xfers[hot_disks[hot_disk_used - 1]].curr_value)))
+         continue;
+
+/* insert into the list, which is sorted by falling rate */
+      h = (hot_disk_used < hot_disk_count) ? hot_disk_used++ : hot_disk_used - 1;
+
+      while ((h > 0) && (xfers[hot_disks[h - 1]].curr_value < xfers[i].curr_value))
+      {
+         hot_disks[h] = hot_disks[h - 1];
+         h--;
+      }
+
+      hot_disks[h] = i;
+   }
+}
+
+
+
+/* Track which disks keep missing from the snapshots.  A disk missing
+   disable_after times in a row is disabled and only looked at again after
+   a backoff which doubles with every failed retry. */
+static void
+update_health( double now )
+{
+   int i;
+
+
+   for (i = 0;  i < aixdisk_count;  i++)
+   {
+/* in incremental mode only the disks of this cycle are checked */
+      if (! disk_due[i])
+         continue;
+
+      if (disk_seen[i])
+      {
+         if (! aixdisks[i].enabled)
+            syslog( LOG_NOTICE, "aixdisk: %s is back, enabled again", aixdisks[i].devName );
+
+         aixdisks[i].enabled = TRUE;
+         aixdisks[i].failures = 0;
+         aixdisks[i].backoff = 0.0;
+         metric_values[M_HEALTH][i].curr_value = HEALTH_OK;
+      }
+      else if (aixdisks[i].enabled)
+      {
+         aixdisks[i].failures++;
+         metric_values[M_HEALTH][i].curr_value = HEALTH_MISSING;
+
+         if (aixdisks[i].failures >= disable_after)
+         {
+            aixdisks[i].enabled = FALSE;
+            aixdisks[i].backoff = retry_backoff;
+            aixdisks[i].retry_at = now + aixdisks[i].backoff;
+            metric_values[M_HEALTH][i].curr_value = HEALTH_DISABLED;
+
+            syslog( LOG_WARNING, "aixdisk: %s missing from %d snapshots, disabled for %.0f seconds",
+                    aixdisks[i].devName, aixdisks[i].failures, aixdisks[i].backoff );
+         }
+      }
+      else if (now >= aixdisks[i].retry_at)
+      {
+/* the retry failed as well */
+         aixdisks[i].backoff *= 2.0;
+         if (aixdisks[i].backoff > RETRY_BACKOFF_MAX)
+            aixdisks[i].backoff = RETRY_BACKOFF_MAX;
+         aixdisks[i].retry_at = now + aixdisks[i].backoff;
+      }
+   }
+}
+
+
+
+/* Add the free space of the disks read in this cycle to their regression,
+   also if it did not change, so the fill rate falls back towards zero once
+   a disk stops filling up.  The fill rate is the slope of the regression,
+   the time to full is the current free space at that rate. */
+static void
+update_fill( double now )
+{
+   aixdisk_fill_t *r;
+   double free,
+          dt,
+          df,
+          decay,
+          denom,
+          slope;
+   int i;
+
+
+   for (i = 0;  i < aixdisk_count;  i++)
+   {
+      r = &disk_fill[i];
+      free = metric_values[M_FREE][i].curr_value;
+
+      if (disk_seen[i])
+      {
+/* move the origin to the new point, decaying the old ones */
+         dt = now - r->time;
+         df = free - r->free;
+         decay = (r->w > 0.0) ? exp( -dt / fill_window ) : 0.0;
+
+         r->tt = decay * (r->tt - 2.0 * dt * r->t + dt * dt * r->w);
+         r->tf = decay * (r->tf - dt * r->f - df * (r->t - dt * r->w));
+         r->t = decay * (r->t - dt * r->w);
+         r->f = decay * (r->f - df * r->w);
+         r->w = decay * r->w + 1.0;
+
+         r->time = now;
+         r->free = free;
+      }
+
+      denom = r->w * r->tt - r->t * r->t;
+      if (denom <= 0.0)
+      {
+         metric_values[M_FILL_RATE][i].curr_value = 0.0;
+         metric_values[M_TIME_TO_FULL][i].curr_value = -1.0;
+         continue;
+      }
+
+      slope = (r->w * r->tf - r->t * r->f) / denom;   /* bytes per second */
+
+      metric_values[M_FILL_RATE][i].curr_value = -slope * 3600.0;
+      metric_values[M_TIME_TO_FULL][i].curr_value =
+         (slope >= 0.0) ? -1.0 : (free > 0.0) ? free / -slope / 3600.0 : 0.0;
+   }
+}
+
+
+
+/* Compare the tick conversion and the CPU count with the last cycle.  After
+   a change the counters of the interval were partly taken under the old
+   configuration and may have jumped, so they only serve as new baselines,
+   and the learned per disk baselines start over. */
+static int
+check_config( int nCPUs )
+{
+   int changed;
+   int i;
+
+
+   changed = (config_ncpus != 0)
+             && ((_system_configuration.Xint != config_xint)
+                 || (_system_configuration.Xfrac != config_xfrac)
+                 || (nCPUs != config_ncpus));
+
+   if (changed)
+   {
+      syslog( LOG_NOTICE, "aixdisk: partition configuration changed (Xint/Xfrac %u/%u to %u/%u, %d to %d CPUs), "
+              "counters re-baselined", config_xint, config_xfrac,
+              (unsigned int) _system_configuration.Xint, (unsigned int) _system_configuration.Xfrac,
+              config_ncpus, nCPUs );
+
+      memset( disk_rebase, TRUE, aixdisk_count );
+      memset( serv_baseline, 0, sizeof( double ) * aixdisk_count );
+
+      if (peak_time != NULL)
+      {
+         pthread_mutex_lock( &peak_lock );
+         for (i = 0;  i < aixdisk_count;  i++)
+            peak_time[i] = 0.0;
+         pthread_mutex_unlock( &peak_lock );
+      }
+   }
+
+   config_xint = _system_configuration.Xint;
+   config_xfrac = _system_configuration.Xfrac;
+   config_ncpus = nCPUs;
+
+   return( changed );
+}
+
+
+
+/* Compute all values of this cycle from the snapshot in disk_stats */
+/* Delta and rate computation over all disks.  Disks missing from this
+   snapshot keep their previous values, so do the disks read for the first
+   time after a configuration change.  A disk is quiet when none of its
+   counters moved in this and the previous interval. */
+static void
+compute_deltas( void )
+{
+   int c,
+       i;
+
+
+   memset( disk_moved, FALSE, aixdisk_count );
+   disk_active_count = 0;
+
+   for (c = 0;  c < active_counters;  c++)
+      counter_deltas( aixdisk_count, ctr_total[c], ctr_last_total[c], ctr_delta[c], disk_moved );
+
+   for (i = 0;  i < aixdisk_count;  i++)
+   {
+      if ((! disk_seen[i]) || disk_rebase[i])
+      {
+         for (c = 0;  c < active_counters;  c++)
+            ctr_delta[c][i] = -1.0;
+
+         if (disk_seen[i])
+            disk_rebase[i] = FALSE;
+
+         disk_moved[i] = TRUE;
+      }
+
+      disk_quiet[i] = disk_idle[i] && ! disk_moved[i];
+      disk_idle[i] = ! disk_moved[i];
+
+      if (! disk_quiet[i])
+         disk_active[disk_active_count++] = i;
+   }
+}
+
+
+
+/* Note a disk which is not in the device list of the init, once */
+static void
+note_added_disk( const char *name )
+{
+   if (added_disks == NULL)
+      added_disks = apr_hash_make( pool );
+
+   if (apr_hash_get( added_disks, name, APR_HASH_KEY_STRING ) != NULL)
+      return;
+
+   apr_hash_set( added_disks, apr_pstrdup( pool, name ), APR_HASH_KEY_STRING, "" );
+   added_count++;
+
+   syslog( LOG_NOTICE, "aixdisk: %s was added after the init, it is reported after a restart of gmond", name );
+}
+
+
+
+static void
+process_disks( double now, int count, int nCPUs )
+{
+   int i,
+       devIndex,
+       hint;
+   int refresh_static;
+
+
+/* values change from here on, keep scrapes out until they are consistent */
+   pthread_mutex_lock( &snapshot_lock );
+
+   for (i = 0;  i < aixdisk_count;  i++)
+      disk_seen[i] = FALSE;
+
+/* a changed device list forces a refresh of the static properties, in
+   incremental mode they are taken along whenever a disk is read */
+   refresh_static = (static_last_read == 0.0)
+                    || ((now - static_last_read) >= static_refresh)
+                    || (count != static_last_count)
+                    || (collect_budget > 0);
+
+   static_last_count = count;
+
+   config_changed = check_config( nCPUs );
+
+   update_factors( nCPUs );
+
+   hint = 0;
+
+   for (i = 0;  i < count;  i++)
+   {
+/* records come in device order, also when only a slice was read */
+      devIndex = find_disk( DISK_STAT( i )->name, hint );
+      if (devIndex < 0)
+      {
+         note_added_disk( DISK_STAT( i )->name );
+         continue;
+      }
+
+      hint = devIndex + 1;
+      if (disk_seen[devIndex])
+         continue;
+
+/* disabled disks are skipped until their next retry */
+      if ((! aixdisks[devIndex].enabled) && (now < aixdisks[devIndex].retry_at))
+         continue;
+
+      if (refresh_static)
+         store_disk_static( devIndex, DISK_STAT( i ) );
+
+      store_disk( devIndex, DISK_STAT( i ), now );
+      disk_seen[devIndex] = TRUE;
+   }
+
+   if (refresh_static)
+      static_last_read = now;
+
+   update_health( now );
+
+   update_fill( now );
+
+
+   TRACE_SPAN( "deltas", aixdisk_count, compute_deltas() );
+
+   TRACE_SPAN( "compute", aixdisk_count, compute_metrics( aixdisk_count ) );
+
+   if (hot_disk_count > 0)
+      select_hot_disks();
+
+   snapshot_time = now;
+
+   pthread_mutex_unlock( &snapshot_lock );
+
+
+/* flag every value which moved beyond the change epsilon */
+   TRACE_SPAN( "mark_changed", aixdisk_count, mark_changed() );
+
+   if (slo_count > 0)
+      TRACE_SPAN( "slo", slo_count, check_slo() );
+
+   if (group_count > 0)
+      TRACE_SPAN( "groups", group_count, compute_groups() );
+
+   if (disk_extended)
+      TRACE_SPAN( "saturation_max", aixdisk_count, compute_saturation_max() );
+
+   if (shm_map != NULL)
+      TRACE_SPAN( "publish_shm", aixdisk_count, publish_ring( shm_map, shm_metric, now ) );
+
+   if (history_map != NULL)
+      TRACE_SPAN( "publish_history", aixdisk_count, publish_ring( history_map, history_metric, now ) );
+
+
+/* persist the baselines every now and then */
+   if ((state_map != NULL) && (get_monotonic_time() - state_map->saved >= STATE_INTERVAL))
+      save_state( now );
+}
+
+
+
+/* Background collector for deadline bounded collection.  It only runs the
+   perfstat calls, all values are still computed in the gmond thread. */
+static void *
+collector_loop( void *arg )
+{
+   int count,
+       nCPUs;
+   double t;
+
+
+   pthread_mutex_lock( &collect_lock );
+
+   while (! collect_stop)
+   {
+      if (! collect_busy)
+      {
+         pthread_cond_wait( &collect_cond, &collect_lock );
+         continue;
+      }
+
+      pthread_mutex_unlock( &collect_lock );
+
+      TRACE_SPAN( "snapshot", count, count = fetch_disks( &nCPUs ) );
+      t = get_current_time();
+
+      pthread_mutex_lock( &collect_lock );
+
+      collect_count = count;
+      collect_ncpus = nCPUs;
+      collect_time = t;
+      collect_busy = FALSE;
+
+      pthread_cond_broadcast( &collect_done );
+   }
+
+   pthread_mutex_unlock( &collect_lock );
+
+   thread_stopped();
+
+   return( NULL );
+}
+
+
+
+/* Ask the collector for a snapshot and wait for it until collect_deadline
+   after the request.  Without it in time the previous values are kept and
+   flagged as stale. */
+static void
+collect_bounded( void )
+{
+   int ready;
+
+
+   pthread_mutex_lock( &collect_lock );
+
+   if (! collect_busy)
+   {
+      collect_busy = TRUE;
+
+      clock_gettime( CLOCK_REALTIME, &collect_until );
+      collect_until.tv_sec += (time_t) collect_deadline;
+      collect_until.tv_nsec += (long) ((collect_deadline - (time_t) collect_deadline) * 1000000000.0);
+      if (collect_until.tv_nsec >= 1000000000L)
+      {
+         collect_until.tv_sec++;
+         collect_until.tv_nsec -= 1000000000L;
+      }
+
+      pthread_cond_signal( &collect_cond );
+   }
+
+/* all callbacks wait for the same deadline, once it has passed for a
+   hung request they return at once */
+   while (collect_busy)
+      if (pthread_cond_timedwait( &collect_done, &collect_lock, &collect_until ) == ETIMEDOUT)
+         break;
+
+   ready = ! collect_busy;
+
+   pthread_mutex_unlock( &collect_lock );
+
+   if (ready)
+   {
+      snapshot_stale = FALSE;
+      process_disks( collect_time, collect_count, collect_ncpus );
+   }
+   else if (! snapshot_stale)
+   {
+      snapshot_stale = TRUE;
+      syslog( LOG_WARNING, "aixdisk: disk statistics not collected within %.1f seconds, serving stale values",
+              collect_deadline );
+   }
+}
+
+
+
+/* Take one snapshot of all disks and compute all values of this cycle */
+static void
+read_disks( double now )
+{
+   int count,
+       nCPUs;
+
+
+   if (aixdisk_count == 0)
+      return;
+
+#ifdef AIXDISK_TRACE
+   if (trace_enabled)
+      check_trace();
 #endif
 
+   if (collect_running)
+   {
+      TRACE_SPAN( "collect_bounded", aixdisk_count, collect_bounded() );
+      return;
+   }
+
+   TRACE_SPAN( "snapshot", count, count = fetch_disks( &nCPUs ) );
+
+   TRACE_SPAN( "process", count, process_disks( now, count, nCPUs ) );
+}
+
+
+
+static double
+time_diff( int aixdisk_index, double *now )
+{
+   *now = get_current_time();
+
+/* all disks come from one snapshot, a missing or disabled disk must not
+   force a new one on every call */
+   return( *now - snapshot_time );
+}
+
+
+
+/* Serve the value of metric m of a disk from the current snapshot */
+static g_val_t
+aixdisk_value_func( unsigned int m, int devIndex )
+{
+   g_val_t val;
+
+
+   val.d = aixdisk_metric_data[m][devIndex].curr_value;
+
+   return( val );
+}
+
+
+/* Initialize the given metric by allocating the per metric data
+   structure and inserting a metric definition for each network
+   interface found.
+*/
+static aixdisk_data_t *init_metric( apr_pool_t *p,
+                                    apr_array_header_t *ar,
+                                    int aixdisk_count,
+                                    const char *name,
+                                    const char *desc,
+                                    const char *units )
+{
+   int i;
+   Ganglia_25metric *gmi;
+   aixdisk_data_t *aix_hdisk;
+   char *shared_units,
+        *shared_slope,
+        *shared_fmt,
+        *shared_desc;
+
+
+   aix_hdisk = apr_pcalloc( p, sizeof( aixdisk_data_t ) * aixdisk_count );
+
+   aixdisk_metric_name[aixdisk_metric_count] = name;
+   aixdisk_metric_desc[aixdisk_metric_count] = desc;
+   aixdisk_metric_data[aixdisk_metric_count++] = aix_hdisk;
+
+/* in packed mode the single metrics are not registered with gmond */
+   if (packed_mode)
+      return( aix_hdisk );
+
+/* only the name is unique per disk, all other strings are shared */
+   shared_units = intern_string( p, units );
+   shared_slope = intern_string( p, "both" );
+   shared_fmt = intern_string( p, "%.1f" );
+   shared_desc = intern_string( p, desc );
+
+   for (i = 0;  i < aixdisk_count;  i++)
+   {
+      gmi = apr_array_push( ar );
+
+      /* gmi->key will be automatically assigned by gmond */
+      gmi->name = apr_psprintf( p, "%s_%s", aixdisks[i].devName, name );
+      gmi->tmax = 60;
+      gmi->type = GANGLIA_VALUE_DOUBLE;
+      gmi->units = shared_units;
+      gmi->slope = shared_slope;
+      gmi->fmt = shared_fmt;
+      gmi->msg_size = UDP_HEADER_SIZE + 16;
+      gmi->desc = shared_desc;
+   }
+
+   return( aix_hdisk);
+}
+
+
+
+/* Resolve the packed_metrics parameter against the initialized metrics and
+   register one packed string metric per disk */
+static void
+init_packed_metrics( apr_pool_t *p,
+                     apr_array_header_t *ar,
+                     const char *list )
+{
+   char *names,
+        *name,
+        *last,
+        *layout;
+   unsigned int m;
+   int i;
+   Ganglia_25metric *gmi;
+
+
+   packed_count = 0;
+   layout = "";
+
+   names = apr_pstrdup( p, list );
+   for (name = apr_strtok( names, ", ", &last );
+        (name != NULL) && (packed_count < PACKED_MAX_VALUES);
+        name = apr_strtok( NULL, ", ", &last ))
+   {
+      for (m = 0;  m < aixdisk_metric_count;  m++)
+         if (strcmp( name, aixdisk_metric_name[m] ) == 0)
+            break;
+
+      if (m == aixdisk_metric_count)
+      {
+         syslog( LOG_WARNING, "aixdisk: unknown metric %s in packed_metrics ignored", name );
+         continue;
+      }
+
+      packed_metric[packed_count] = m;
+      packed_type[packed_count] = aixdisk_metric_defs[aixdisk_metric_id[m]].packed;
+      if (packed_type[packed_count] == 0)
+         packed_type[packed_count] = 'f';
+
+      layout = apr_psprintf( p, "%s%s%s:%c", layout, (packed_count > 0) ? "," : "",
+                             name, packed_type[packed_count] );
+      packed_count++;
+   }
+
+   packed_cache = apr_pcalloc( p, MAX_G_STRING_SIZE * NONZERO( aixdisk_count ) );
+
+   layout = intern_string( p, apr_psprintf( p, "packed metrics: %s", layout ) );
+
+   for (i = 0;  i < aixdisk_count;  i++)
+   {
+      gmi = apr_array_push( ar );
+
+      /* gmi->key will be automatically assigned by gmond */
+      gmi->name = apr_psprintf( p, "%s_packed", aixdisks[i].devName );
+      gmi->tmax = 60;
+      gmi->type = GANGLIA_VALUE_STRING;
+      gmi->units = intern_string( p, "" );
+      gmi->slope = intern_string( p, "both" );
+      gmi->fmt = intern_string( p, "%s" );
+      gmi->msg_size = UDP_HEADER_SIZE + MAX_G_STRING_SIZE;
+      gmi->desc = layout;
+   }
+}
+
+
+
+/* Encode the selected metrics of a disk, re-encoding only if one of them
+   moved since the last call */
+static g_val_t
+aixdisk_packed_func( int devIndex )
+{
+   unsigned int words[PACKED_MAX_VALUES],
+                idx;
+   int i,
+       dirty;
+   g_val_t val;
+
+
+   dirty = (packed_cache[devIndex][0] == '\0');
+
+   for (i = 0;  i < packed_count;  i++)
+   {
+      idx = packed_metric[i] * aixdisk_count + devIndex;
+
+      if (DIRTY_TEST( idx ))
+      {
+         aixdisk_published[idx] = aixdisk_metric_data[packed_metric[i]][devIndex].curr_value;
+         DIRTY_CLEAR( idx );
+         dirty = TRUE;
+      }
+
+      words[i] = packed_word( packed_type[i], aixdisk_published[idx] );
+   }
+
+   if (dirty)
+      packed_encode( packed_cache[devIndex], words, packed_count );
+
+   strcpy( val.str, packed_cache[devIndex] );
+
+   return( val );
+}
+
+
+
+/* Register a host level metric served by func */
+static void
+init_host_metric( apr_pool_t *p,
+                  apr_array_header_t *ar,
+                  char *name,
+                  char *desc,
+                  char *units,
+                  Ganglia_value_types type,
+                  host_metric_func_t func,
+                  int arg )
+{
+   Ganglia_25metric *gmi;
+
+
+   if (host_metric_count == MAX_HOST_METRICS)
+      return;
+
+   if (host_metric_count == 0)
+      host_metric_base = ar->nelts;
+
+   host_metric_func[host_metric_count] = func;
+   host_metric_arg[host_metric_count++] = arg;
+
+   gmi = apr_array_push( ar );
+
+   /* gmi->key will be automatically assigned by gmond */
+   gmi->name = name;
+   gmi->tmax = 60;
+   gmi->type = type;
+   gmi->units = intern_string( p, units );
+   gmi->slope = intern_string( p, "both" );
+   gmi->fmt = intern_string( p, (type == GANGLIA_VALUE_STRING) ? "%s" :
+                                (type == GANGLIA_VALUE_DOUBLE) ? "%.1f" : "%u" );
+   gmi->msg_size = UDP_HEADER_SIZE + ((type == GANGLIA_VALUE_STRING) ? MAX_G_STRING_SIZE : 16);
+   gmi->desc = desc;
+}
+
+
+
+static g_val_t
+slo_breaches_func( int arg )
+{
+   g_val_t val;
+
+
+   val.uint32 = slo_breaches;
+
+   return( val );
+}
+
+
+
+static g_val_t
+slo_breach_list_func( int arg )
+{
+   g_val_t val;
+
+
+   strcpy( val.str, slo_list );
+
+   return( val );
+}
+
+
+
+static g_val_t
+saturation_max_func( int arg )
+{
+   g_val_t val;
+
+
+   val.d = saturation_max;
+
+   return( val );
+}
+
+
+
+static g_val_t
+reconfigured_func( int arg )
+{
+   g_val_t val;
+
+
+   val.uint32 = config_changed;
+
+   return( val );
+}
+
+
+
+static g_val_t
+added_func( int arg )
+{
+   g_val_t val;
+
+
+   val.uint32 = added_count;
+
+   return( val );
+}
+
+
+
+static g_val_t
+stale_func( int arg )
+{
+   g_val_t val;
+
+
+   val.uint32 = snapshot_stale;
+
+   return( val );
+}
+
+
+
+static g_val_t
+snapshot_age_func( int arg )
+{
+   g_val_t val;
+
+
+   val.d = get_current_time() - snapshot_time;
+
+   return( val );
+}
+
+
+
+/* Start the collector thread for deadline bounded collection */
+static void
+init_collector( apr_pool_t *p, apr_array_header_t *ar )
+{
+   thread_started();
+   if (pthread_create( &collect_thread, NULL, collector_loop, NULL ) != 0)
+   {
+      thread_stopped();
+      syslog( LOG_WARNING, "aixdisk: cannot start the collector, collecting synchronously" );
+      return;
+   }
+
+/* a hung perfstat call must not block gmond's shutdown either */
+   pthread_detach( collect_thread );
+   collect_running = TRUE;
+
+   init_host_metric( p, ar, "aixdisk_stale", "disk values are stale, collection missed its deadline (0/1)",
+                     "", GANGLIA_VALUE_UNSIGNED_INT, stale_func, 0 );
+   init_host_metric( p, ar, "aixdisk_snapshot_age", "age of the disk values",
+                     "sec", GANGLIA_VALUE_DOUBLE, snapshot_age_func, 0 );
+}
+
+
+
+/* Stop the workers, like the collector they are only waited for at most
+   THREAD_EXIT_WAIT seconds in the cleanup */
+static void
+close_workers( void )
+{
+   pthread_mutex_lock( &worker_lock );
+   worker_stop = TRUE;
+   pthread_cond_broadcast( &worker_start );
+   pthread_mutex_unlock( &worker_lock );
+
+   collect_workers = 0;
+}
+
+
+
+/* Start collect_workers threads, each reading an equal contiguous range
+   of the disks */
+static void
+init_workers( apr_pool_t *p )
+{
+   int w;
+
+
+   if (collect_workers > aixdisk_count)
+      collect_workers = aixdisk_count;
+   if (collect_workers < 2)
+   {
+      collect_workers = 0;
+      return;
+   }
+
+   worker_thread = apr_pcalloc( p, sizeof( pthread_t ) * collect_workers );
+   chunk_first = apr_pcalloc( p, sizeof( int ) * (collect_workers + 1) );
+   chunk_count = apr_pcalloc( p, sizeof( int ) * collect_workers );
+   chunk_stats = apr_pcalloc( p, sizeof( perfstat_disk_t * ) * collect_workers );
+   chunk_capacity = apr_pcalloc( p, sizeof( int ) * collect_workers );
+
+   for (w = 0;  w <= collect_workers;  w++)
+      chunk_first[w] = (int) ((long long) aixdisk_count * w / collect_workers);
+
+   for (w = 0;  w < collect_workers;  w++)
+   {
+      thread_started();
+      if (pthread_create( &worker_thread[w], NULL, worker_loop, (void *) (long) w ) != 0)
+      {
+         thread_stopped();
+         syslog( LOG_WARNING, "aixdisk: cannot start collection worker %d, collecting in one piece", w );
+         close_workers();
+         return;
+      }
+
+      pthread_detach( worker_thread[w] );
+   }
+}
+
+
+
+static void
+close_collector( void )
+{
+   if (! collect_running)
+      return;
+
+   pthread_mutex_lock( &collect_lock );
+   collect_stop = TRUE;
+   pthread_cond_signal( &collect_cond );
+   pthread_mutex_unlock( &collect_lock );
+
+   collect_running = FALSE;
+}
+
+
+
+/* Fold one sampler snapshot into the per disk peak rates */
+static void
+sample_peaks( int count, double now )
+{
+   const perfstat_disk_t *d;
+   u_longlong_t total;
+   double delta,
+          rate;
+   int i,
+       j,
+       c,
+       devIndex,
+       hint;
+
+
+   hint = 0;
+
+   for (i = 0;  i < count;  i++)
+   {
+      d = STAT_RECORD( peak_stats, i );
+
+      devIndex = find_disk( d->name, hint );
+      if (devIndex < 0)
+         continue;
+
+      hint = devIndex + 1;
+
+      for (j = 0;  j < peak_counter_count;  j++)
+      {
+         c = peak_counter[j];
+         total = FIELD( d, counter_field[c] );
+
+/* the first sample of a disk and counter resets only set the baseline */
+         delta = (double) (long long) (total - peak_last[c][devIndex]);
+         if ((peak_time[devIndex] != 0.0) && (delta >= 0.0) && (now > peak_time[devIndex]))
+         {
+            rate = delta / (now - peak_time[devIndex]);
+            if (rate > peak_max[c][devIndex])
+               peak_max[c][devIndex] = rate;
+         }
+
+         peak_last[c][devIndex] = total;
+      }
+
+      peak_time[devIndex] = now;
+   }
+}
+
+
+
+/* Mark the disks the sampler reads: the enabled ones, in incremental mode
+   only those of the next slice and the hot disks, the others are not
+   published next cycle */
+static void
+select_peak_disks( void )
+{
+   int i,
+       h,
+       n;
+
+
+   pthread_mutex_lock( &snapshot_lock );
+
+   if (collect_budget > 0)
+   {
+      memset( peak_want, FALSE, aixdisk_count );
+
+      for (i = rotate_next, n = 0;  n < collect_budget;  n++, i = (i + 1) % aixdisk_count)
+         peak_want[i] = TRUE;
+
+      for (h = 0;  h < hot_disk_used;  h++)
+         peak_want[hot_disks[h]] = TRUE;
+   }
+   else
+      memset( peak_want, TRUE, aixdisk_count );
+
+   for (i = 0;  i < aixdisk_count;  i++)
+      if (! aixdisks[i].enabled)
+         peak_want[i] = FALSE;
+
+   pthread_mutex_unlock( &snapshot_lock );
+}
+
 
-   return( val );
+
+/* Read the disks marked in peak_want into peak_stats, one name bounded
+   range per run of marked disks.  Returns the number of records. */
+static int
+fetch_peaks( void )
+{
+   int count,
+       first,
+       stop;
+
+
+   count = 0;
+
+   for (first = 0;  first < aixdisk_count;  first = stop)
+   {
+      stop = first + 1;
+      if (! peak_want[first])
+         continue;
+
+      while ((stop < aixdisk_count) && peak_want[stop])
+         stop++;
+
+      count += fetch_range( &peak_stats, &peak_capacity, count, first, stop );
+   }
+
+   return( count );
 }
 
 
-static g_val_t
-aixdisk_wserv_func( int aixdisk_index )
+
+/* Background sampler, one snapshot of the disks worth sampling every
+   peak_interval seconds, independent of the number of metrics */
+static void *
+peak_loop( void *arg )
 {
-   double delta_t,
-          now;
-   g_val_t val;
+   struct timespec next;
+   int count;
+   double t;
 
 
-   if (aixdisks[aixdisk_index].enabled)
+   clock_gettime( CLOCK_REALTIME, &next );
+
+   pthread_mutex_lock( &peak_lock );
+
+   while (! peak_stop)
    {
-      delta_t = time_diff( aixdisk_index, &now );
+      next.tv_sec += (time_t) peak_interval;
+      next.tv_nsec += (long) ((peak_interval - (time_t) peak_interval) * 1000000000.0);
+      if (next.tv_nsec >= 1000000000L)
+      {
+         next.tv_sec++;
+         next.tv_nsec -= 1000000000L;
+      }
 
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
+      while ((! peak_stop)
+             && (pthread_cond_timedwait( &peak_cond, &peak_lock, &next ) != ETIMEDOUT))
+         ;
 
-      val.d = aixdisk_wserv[aixdisk_index].curr_value;
+      if (peak_stop)
+         break;
+
+      pthread_mutex_unlock( &peak_lock );
+
+      select_peak_disks();
+      TRACE_SPAN( "peak_sample", count, count = fetch_peaks() );
+      t = get_current_time();
+
+      pthread_mutex_lock( &peak_lock );
+
+      if (count > 0)
+         sample_peaks( count, t );
    }
-   else
-      val.d = -1.0;
 
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_wserv_func = %f\n", val.d ); fflush( stderr );
-#endif
+   pthread_mutex_unlock( &peak_lock );
 
+   thread_stopped();
 
-   return( val );
+   return( NULL );
 }
 
 
+
+/* Start the peak sampler, without it the peaks are the interval averages */
+static void
+init_sampler( void )
+{
+   thread_started();
+   if (pthread_create( &peak_thread, NULL, peak_loop, NULL ) != 0)
+   {
+      thread_stopped();
+      syslog( LOG_WARNING, "aixdisk: cannot start the peak sampler, peaks are interval averages" );
+      return;
+   }
+
+   pthread_detach( peak_thread );
+   peak_running = TRUE;
+}
+
+
+
+static void
+close_sampler( void )
+{
+   if (! peak_running)
+      return;
+
+   pthread_mutex_lock( &peak_lock );
+   peak_stop = TRUE;
+   pthread_cond_signal( &peak_cond );
+   pthread_mutex_unlock( &peak_lock );
+
+   peak_running = FALSE;
+}
+
+
+
 static g_val_t
-aixdisk_wtimeout_func( int aixdisk_index )
+group_value_func( int arg )
 {
-   double delta_t,
-          now;
    g_val_t val;
 
 
-   if (aixdisks[aixdisk_index].enabled)
+   val.d = disk_groups[arg / NUM_GROUP_VALUES].value[arg % NUM_GROUP_VALUES];
+
+   return( val );
+}
+
+
+
+/* Compile every group_<name> parameter, a list of disk name patterns, into
+   the list of its member disks and register the group's rollups */
+static void
+init_groups( apr_pool_t *p, apr_array_header_t *ar )
+{
+   static const char *suffix[NUM_GROUP_VALUES] = {
+      "xfers", "rbytes", "wbytes", "busy",
+      "avg_serv",
+   };
+   static const char *desc[NUM_GROUP_VALUES] = {
+      "transfers to/from the disks of the group",
+      "bytes read from the disks of the group",
+      "bytes written to the disks of the group",
+      "highest percentage of time a disk of the group is busy",
+      "average service time per transfer of the group",
+   };
+   static const char *units[NUM_GROUP_VALUES] = {
+      "transfers/sec", "bytes/sec", "bytes/sec", "%",
+      "ms",
+   };
+   aixdisk_group_t *g;
+   mmparam *params;
+   char *patterns,
+        *pattern,
+        *last;
+   int i,
+       j,
+       v;
+
+
+   if ((aixdisk_module.module_params_list == NULL) || (aixdisk_count == 0))
+      return;
+
+   group_add = disk_extended ? group_add_extended : group_add_basic;
+
+   params = (mmparam *) aixdisk_module.module_params_list->elts;
+
+   for (j = 0;  j < aixdisk_module.module_params_list->nelts;  j++)
+   {
+      if ((strncasecmp( params[j].name, "group_", 6 ) != 0) || (params[j].name[6] == '\0'))
+         continue;
+
+      if (group_count == MAX_DISK_GROUPS)
+      {
+         syslog( LOG_WARNING, "aixdisk: more than %d disk groups, %s ignored",
+                 MAX_DISK_GROUPS, params[j].name );
+         continue;
+      }
+
+      g = &disk_groups[group_count];
+      g->name = apr_pstrdup( p, params[j].name + 6 );
+      g->members = apr_palloc( p, sizeof( int ) * aixdisk_count );
+      g->count = 0;
+
+/* a disk is a member if any of the patterns matches its name */
+      for (i = 0;  i < aixdisk_count;  i++)
+      {
+         patterns = apr_pstrdup( p, params[j].value );
+         for (pattern = apr_strtok( patterns, ", ", &last );
+              pattern != NULL;
+              pattern = apr_strtok( NULL, ", ", &last ))
+            if (fnmatch( pattern, aixdisks[i].devName, 0 ) == 0)
+            {
+               g->members[g->count++] = i;
+               break;
+            }
+      }
+
+      if (g->count == 0)
+         syslog( LOG_WARNING, "aixdisk: disk group %s has no members", g->name );
+
+/* the average service time needs the extended statistics */
+      for (v = 0;  v < (disk_extended ? NUM_GROUP_VALUES : GRP_AVG_SERV);  v++)
+         init_host_metric( p, ar, apr_psprintf( p, "aixdisk_%s_%s", g->name, suffix[v] ),
+                           (char *) desc[v], (char *) units[v], GANGLIA_VALUE_DOUBLE,
+                           group_value_func, group_count * NUM_GROUP_VALUES + v );
+
+      group_count++;
+   }
+}
+
+
+
+/* Parse the slo_thresholds parameter, a list of <metric>:<threshold> */
+static void
+init_slo( apr_pool_t *p, apr_array_header_t *ar, const char *list )
+{
+   char *rules,
+        *rule,
+        *last,
+        *colon;
+   const char *value;
+   double hysteresis;
+   unsigned int m;
+
+
+   value = get_module_param( "slo_hysteresis" );
+   hysteresis = (value != NULL) ? atof( value ) : SLO_HYSTERESIS;
+   if ((hysteresis < 0.0) || (hysteresis >= 1.0))
+      hysteresis = SLO_HYSTERESIS;
+
+   value = get_module_param( "slo_syslog" );
+   slo_syslog = (value != NULL) && ((strcasecmp( value, "yes" ) == 0) || (atoi( value ) != 0));
+
+   rules = apr_pstrdup( p, list );
+   for (rule = apr_strtok( rules, ", ", &last );
+        (rule != NULL) && (slo_count < MAX_SLO_RULES);
+        rule = apr_strtok( NULL, ", ", &last ))
    {
-      delta_t = time_diff( aixdisk_index, &now );
+      colon = strchr( rule, ':' );
+      if (colon != NULL)
+         *colon++ = '\0';
+
+      for (m = 0;  m < aixdisk_metric_count;  m++)
+         if (strcmp( rule, aixdisk_metric_name[m] ) == 0)
+            break;
 
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
+      if ((colon == NULL) || (m == aixdisk_metric_count))
+      {
+         syslog( LOG_WARNING, "aixdisk: invalid SLO rule %s ignored", rule );
+         continue;
+      }
 
-      val.d = aixdisk_wtimeout[aixdisk_index].curr_value;
+      slo_rules[slo_count].metric = m;
+      slo_rules[slo_count].threshold = atof( colon );
+      slo_rules[slo_count].clear = slo_rules[slo_count].threshold * (1.0 - hysteresis);
+      slo_count++;
    }
-   else
-      val.d = -1.0;
 
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_wtimeout_func = %f\n", val.d ); fflush( stderr );
-#endif
+   if (slo_count == 0)
+      return;
 
+   slo_state = apr_pcalloc( p, NONZERO( aixdisk_count ) );
 
-   return( val );
+   init_host_metric( p, ar, "aixdisk_slo_breaches", "number of disks in breach of a latency SLO",
+                     "disks", GANGLIA_VALUE_UNSIGNED_INT, slo_breaches_func, 0 );
+   init_host_metric( p, ar, "aixdisk_slo_breach_list", "disks in breach of a latency SLO",
+                     "", GANGLIA_VALUE_STRING, slo_breach_list_func, 0 );
 }
 
 
-static g_val_t
-aixdisk_wfailed_func( int aixdisk_index )
+
+/* Resolve the history_metrics parameter, all metrics if it is not set */
+static void
+init_history_metrics( apr_pool_t *p, const char *list )
 {
-   double delta_t,
-          now;
-   g_val_t val;
+   char *names,
+        *name,
+        *last;
+   unsigned int m;
 
 
-   if (aixdisks[aixdisk_index].enabled)
+   history_metric_count = 0;
+
+   if ((list == NULL) || (*list == '\0'))
+   {
+      for (m = 0;  m < aixdisk_metric_count;  m++)
+         history_metric[history_metric_count++] = m;
+      return;
+   }
+
+   names = apr_pstrdup( p, list );
+   for (name = apr_strtok( names, ", ", &last );
+        name != NULL;
+        name = apr_strtok( NULL, ", ", &last ))
    {
-      delta_t = time_diff( aixdisk_index, &now );
+      for (m = 0;  m < aixdisk_metric_count;  m++)
+         if (strcmp( name, aixdisk_metric_name[m] ) == 0)
+            break;
 
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
+      if (m == aixdisk_metric_count)
+      {
+         syslog( LOG_WARNING, "aixdisk: unknown metric %s in history_metrics ignored", name );
+         continue;
+      }
 
-      val.d = aixdisk_wfailed[aixdisk_index].curr_value;
+      history_metric[history_metric_count++] = m;
    }
-   else
-      val.d = -1.0;
+}
 
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_wfailed_func = %f\n", val.d ); fflush( stderr );
-#endif
 
 
-   return( val );
+/* Change the tmax of all instances of the given metric */
+static void
+set_metric_tmax( unsigned int m, int tmax )
+{
+   unsigned int i;
+   Ganglia_25metric *gmi;
+
+
+   gmi = (Ganglia_25metric *) metric_info->elts;
+
+   for (i = 0;  i < aixdisk_count;  i++)
+      gmi[m * aixdisk_count + i].tmax = tmax;
 }
 
 
-static g_val_t
-aixdisk_min_wserv_func( int aixdisk_index )
+
+static int aixdisk_metric_init( apr_pool_t *p )
 {
-   double delta_t,
-          now;
-   g_val_t val;
+   int i,
+       c;
+   unsigned int nvalues,
+                m;
+   double now;
+   const char *value;
+   Ganglia_25metric *gmi;
+   struct vario var;
+
+
+/* Enable collection of disk input and output statistics in AIX */
+
+   sys_parm( SYSP_GET, SYSP_V_IOSTRUN, &var );
+   allowDiskPerfCollection = var.v.v_iostrun.value;
+
+   var.v.v_iostrun.value = 1; /* 1 to set & 0 to unset */
+   sys_parm( SYSP_SET, SYSP_V_IOSTRUN, &var );
+
+
+/* Initialize all required data and structures */
+
+#ifdef AIXDISK_TRACE
+   init_trace();
+#endif
+
+   TRACE_SPAN( "enumerate", aixdisk_count, aixdisk_count = detect_aixdisk_devices() );
+
 
+/* Allocate a pool that will be used by this module */
+   apr_pool_create( &pool, p );
+
+   metric_info = apr_array_make( pool, 2, sizeof( Ganglia_25metric ) );
 
-   if (aixdisks[aixdisk_index].enabled)
+
+/* columnar counter storage */
+   for (c = 0;  c < NUM_COUNTERS;  c++)
    {
-      delta_t = time_diff( aixdisk_index, &now );
+      ctr_total[c] = apr_pcalloc( pool, sizeof( u_longlong_t ) * NONZERO( aixdisk_count ) );
+      ctr_last_total[c] = apr_pcalloc( pool, sizeof( u_longlong_t ) * NONZERO( aixdisk_count ) );
+      ctr_delta[c] = apr_pcalloc( pool, sizeof( double ) * NONZERO( aixdisk_count ) );
+   }
 
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
+   disk_delta_t = apr_pcalloc( pool, sizeof( double ) * NONZERO( aixdisk_count ) );
+   serv_baseline = apr_pcalloc( pool, sizeof( double ) * NONZERO( aixdisk_count ) );
+   disk_fill = apr_pcalloc( pool, sizeof( aixdisk_fill_t ) * NONZERO( aixdisk_count ) );
+   disk_seen = apr_pcalloc( pool, NONZERO( aixdisk_count ) );
+   disk_due = apr_pcalloc( pool, NONZERO( aixdisk_count ) );
+   disk_rebase = apr_pcalloc( pool, NONZERO( aixdisk_count ) );
+   disk_moved = apr_pcalloc( pool, NONZERO( aixdisk_count ) );
+   disk_idle = apr_pcalloc( pool, NONZERO( aixdisk_count ) );
+   disk_quiet = apr_pcalloc( pool, NONZERO( aixdisk_count ) );
+   disk_active = apr_pcalloc( pool, sizeof( unsigned int ) * NONZERO( aixdisk_count ) );
+
+   aixdisk_metric_data = apr_pcalloc( pool, sizeof( aixdisk_data_t * ) * MAX_DISK_METRICS );
+
+   value = get_module_param( "static_refresh" );
+   if (value != NULL)
+      static_refresh = atof( value );
+   if (static_refresh < MIN_THRESHOLD)
+      static_refresh = MIN_THRESHOLD;
+
+   value = get_module_param( "packed_metrics" );
+   if ((value != NULL) && (*value != '\0'))
+      packed_mode = TRUE; /* resolved after all metrics are initialized */
+
+   value = get_module_param( "disable_after" );
+   if (value != NULL)
+      disable_after = atoi( value );
+   if (disable_after < 1)
+      disable_after = 1;
+
+   value = get_module_param( "retry_backoff" );
+   if (value != NULL)
+      retry_backoff = atof( value );
+   if (retry_backoff < MIN_THRESHOLD)
+      retry_backoff = MIN_THRESHOLD;
+
+   value = get_module_param( "fill_window" );
+   if (value != NULL)
+      fill_window = atof( value );
+   if (fill_window < STATIC_REFRESH)
+      fill_window = STATIC_REFRESH;
+
+   value = get_module_param( "change_epsilon" );
+   if (value != NULL)
+      change_epsilon = atof( value );
+   if (change_epsilon < 0.0)
+      change_epsilon = 0.0;
+
+
+   value = get_module_param( "peak_interval" );
+   if (value != NULL)
+      peak_interval = atof( value );
+   if ((peak_interval <= 0.0) || (aixdisk_count == 0))
+      peak_interval = 0.0;
+
+
+/* Initialize each metric, the extended ones only if they are available
+   and the peaks only with the sampler */
+   aixdisk_metric_count = 0;
+
+   for (m = 0;  m < NUM_METRICS;  m++)
+   {
+      if ((m >= NUM_BASIC_METRICS) && (m < FIRST_PEAK_METRIC) && ! disk_extended)
+         continue;
+      if ((m >= FIRST_PEAK_METRIC) && (peak_interval == 0.0))
+         continue;
 
-      val.d = aixdisk_min_wserv[aixdisk_index].curr_value;
+      aixdisk_metric_id[aixdisk_metric_count] = m;
+      metric_values[m] = init_metric( pool,
+                                      metric_info,
+                                      aixdisk_count,
+                                      aixdisk_metric_defs[m].name,
+                                      aixdisk_metric_defs[m].desc,
+                                      aixdisk_metric_defs[m].units );
+
+/* the static properties only change on a refresh, allow for two of them.
+   With the extended statistics xrate counts the read transfers, so there
+   it is read every cycle like a gauge. */
+      if ((aixdisk_metric_defs[m].kind == KIND_STATIC)
+          && ((m != M_XRATE) || ! disk_extended))
+      {
+         static_metric[static_metric_count++] = m;
+         if (! packed_mode)
+            set_metric_tmax( aixdisk_metric_count - 1, (int) (2.0 * static_refresh) );
+      }
+      else if ((aixdisk_metric_defs[m].kind == KIND_GAUGE)
+               || (aixdisk_metric_defs[m].kind == KIND_STATIC))
+         gauge_metric[gauge_metric_count++] = m;
+      else if (aixdisk_metric_defs[m].kind == KIND_PEAK)
+      {
+         c = aixdisk_metric_defs[m].counter;
+         peak_counter[peak_counter_count++] = c;
+         peak_last[c] = apr_pcalloc( pool, sizeof( u_longlong_t ) * aixdisk_count );
+         peak_max[c] = apr_palloc( pool, sizeof( double ) * aixdisk_count );
+         for (i = 0;  i < aixdisk_count;  i++)
+            peak_max[c][i] = -1.0;
+      }
    }
-   else
-      val.d = -1.0;
 
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_min_wserv_func = %f\n", val.d ); fflush( stderr );
+   if (packed_mode)
+      init_packed_metrics( pool, metric_info, get_module_param( "packed_metrics" ) );
+
+   value = get_module_param( "slo_thresholds" );
+   if ((value != NULL) && (*value != '\0'))
+      init_slo( pool, metric_info, value );
+
+   init_groups( pool, metric_info );
+
+   if (aixdisk_count > 0)
+      init_host_metric( pool, metric_info, "aixdisk_reconfigured",
+                        "partition configuration changed in the last interval, values kept (0/1)",
+                        "", GANGLIA_VALUE_UNSIGNED_INT, reconfigured_func, 0 );
+
+/* the device list and the group members are taken at init, disks added
+   by cfgmgr later on are only counted */
+   if (aixdisk_count > 0)
+      init_host_metric( pool, metric_info, "aixdisk_added_disks",
+                        "disks added since the start, reported after a restart",
+                        "", GANGLIA_VALUE_UNSIGNED_INT, added_func, 0 );
+
+   if (disk_extended && (aixdisk_count > 0))
+      init_host_metric( pool, metric_info, "aixdisk_saturation_max", "highest saturation score of all disks",
+                        "%", GANGLIA_VALUE_DOUBLE, saturation_max_func, 0 );
+
+   value = get_module_param( "collect_deadline" );
+   if (value != NULL)
+      collect_deadline = atof( value );
+   if (collect_deadline > 0.0)
+      init_collector( pool, metric_info );
+
+   value = get_module_param( "collect_workers" );
+   if (value != NULL)
+      collect_workers = atoi( value );
+   if (collect_workers > 1)
+      init_workers( pool );
+
+
+/* Add a terminator to the array and replace the empty static metric definition
+   array with the dynamic array that we just created
+*/
+   gmi = apr_array_push( metric_info );
+   memset( gmi, 0, sizeof( *gmi ));
+
+   aixdisk_module.metrics_info = (Ganglia_25metric *) metric_info->elts;
+
+
+/* everything is dirty until it has been handed to gmond once */
+   nvalues = aixdisk_metric_count * aixdisk_count;
+   aixdisk_published = apr_pcalloc( pool, sizeof( double ) * NONZERO( nvalues ) );
+   aixdisk_dirty = apr_palloc( pool, (nvalues + 8) / 8 );
+   memset( aixdisk_dirty, 0xFF, (nvalues + 8) / 8 );
+
+
+#ifndef STAND_ALONE
+   if (aixdisk_module.metrics_info[0].name != NULL)
+   {
+      /* Initialize the metadata storage once and then store one or more
+       *  key/value pairs.  The define MGROUPS defines the key for the
+       *  grouping attribute.  All metrics of this module carry the same
+       *  metadata, so they share this one table. */
+      MMETRIC_INIT_METADATA( &(aixdisk_module.metrics_info[0]), p );
+      MMETRIC_ADD_METADATA( &(aixdisk_module.metrics_info[0]), MGROUP, "aixdisk" );
+
+      for (i = 1;  aixdisk_module.metrics_info[i].name != NULL;  i++)
+         aixdisk_module.metrics_info[i].metadata = aixdisk_module.metrics_info[0].metadata;
+   }
 #endif
 
 
-   return( val );
-}
+/* initialize the routines which require a time interval */
 
+   boottime = boottime_func_CALLED_ONCE();
+   now = get_current_time();
+   for (i = 0;  i < aixdisk_count;  i++)
+      aixdisks[i].last_read = now - 1.0;
 
-static g_val_t
-aixdisk_max_wserv_func( int aixdisk_index )
-{
-   double delta_t,
-          now;
-   g_val_t val;
 
+/* take over the counter baselines of the previous run if possible,
+   otherwise prime the counters with two snapshots of all disks */
+   state_file = get_module_param( "state_file" );
 
-   if (aixdisks[aixdisk_index].enabled)
+   if ((state_file != NULL) && (aixdisk_count > 0)
+       && (open_state( state_file, now ) == aixdisk_count))
+      read_disks( now );
+   else
    {
-      delta_t = time_diff( aixdisk_index, &now );
+      read_disks( now );
+
+      sleep( 1 );
+      now = get_current_time();
+
+      read_disks( now );
+   }
+
+   save_state( now );
+
 
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
+/* from here on only a slice of the disks is read per cycle, if configured */
+   value = get_module_param( "collect_budget" );
+   if (value != NULL)
+      collect_budget = atoi( value );
 
-      val.d = aixdisk_max_wserv[aixdisk_index].curr_value;
+   value = get_module_param( "hot_disks" );
+   hot_disk_count = (value != NULL) ? atoi( value ) : HOT_DISKS;
+
+   if ((collect_budget > 0) && (collect_budget < aixdisk_count))
+   {
+/* the snapshot buffer holds aixdisk_count records */
+      if (hot_disk_count > aixdisk_count - collect_budget)
+         hot_disk_count = aixdisk_count - collect_budget;
+      if (hot_disk_count < 0)
+         hot_disk_count = 0;
+
+      hot_disks = apr_pcalloc( pool, sizeof( int ) * NONZERO( hot_disk_count ) );
+      if (hot_disk_count > 0)
+         select_hot_disks();
    }
    else
-      val.d = -1.0;
+   {
+      collect_budget = 0;
+      hot_disk_count = 0;
+   }
 
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_max_wserv_func = %f\n", val.d ); fflush( stderr );
-#endif
+
+/* sample the peak rates between the cycles */
+   if (peak_interval > 0.0)
+   {
+      peak_time = apr_pcalloc( pool, sizeof( double ) * aixdisk_count );
+      peak_want = apr_pcalloc( pool, aixdisk_count );
+      if (grow_stats( &peak_stats, &peak_capacity, aixdisk_count ))
+         init_sampler();
+   }
 
 
-   return( val );
-}
+/* export the snapshots to other processes once the counters are primed */
+   value = get_module_param( "shm_slots" );
+   if (value != NULL)
+      shm_slots = atoi( value );
+   if (shm_slots < 2)
+      shm_slots = 2;
 
+   shm_name = get_module_param( "shm_name" );
+   if ((shm_name != NULL) && (*shm_name != '\0') && (aixdisk_count > 0))
+      open_shm( shm_name );
 
-static g_val_t
-aixdisk_wq_depth_func( int aixdisk_index )
-{
-   double delta_t,
-          now;
-   g_val_t val;
 
+/* keep the recent snapshots on disk for drill-down */
+   value = get_module_param( "history_slots" );
+   if (value != NULL)
+      history_slots = atoi( value );
+   if (history_slots < 2)
+      history_slots = 2;
 
-   if (aixdisks[aixdisk_index].enabled)
+   value = get_module_param( "history_file" );
+   if ((value != NULL) && (*value != '\0') && (aixdisk_count > 0))
    {
-      delta_t = time_diff( aixdisk_index, &now );
+      init_history_metrics( pool, get_module_param( "history_metrics" ) );
+      if (history_metric_count > 0)
+         open_history( value );
+   }
+
 
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
+/* serve the snapshots to Prometheus style scrapers */
+   value = get_module_param( "http_port" );
+   if ((value != NULL) && (atoi( value ) > 0))
+   {
+      const char *address = get_module_param( "http_address" );
 
-      val.d = aixdisk_wq_depth[aixdisk_index].curr_value;
+      open_http( (address != NULL) ? address : HTTP_ADDRESS, atoi( value ) );
    }
-   else
-      val.d = -1.0;
 
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_wq_depth_func = %f\n", val.d ); fflush( stderr );
-#endif
+
+/* return OK */
+   return( 0 );
+}
 
 
-   return( val );
+
+static void aixdisk_metric_cleanup ( void )
+{
+   struct vario var;
+   int running;
+
+
+/* set old value again */
+   var.v.v_iostrun.value = allowDiskPerfCollection;
+   sys_parm( SYSP_SET, SYSP_V_IOSTRUN, &var );
+
+/* keep the counter baselines for the next start */
+   close_state();
+
+   close_shm();
+
+   close_history();
+
+   close_http();
+
+   close_collector();
+
+   close_sampler();
+
+   if (collect_workers > 1)
+      close_workers();
+
+/* the http thread is joined, the others are told to stop and given a
+   moment to, one stuck in perfstat is left behind */
+   running = wait_threads( THREAD_EXIT_WAIT );
+   if (running > 0)
+      syslog( LOG_NOTICE, "aixdisk: %d collection threads did not stop, still in a perfstat call",
+              running );
+
+#ifdef AIXDISK_TRACE
+   close_trace();
+#endif
 }
 
 
+
 static g_val_t
-aixdisk_wq_sampled_func( int aixdisk_index )
+dispatch_metric( int metric_index )
 {
+   g_val_t val;
+   int devIndex;
    double delta_t,
           now;
-   g_val_t val;
 
 
-   if (aixdisks[aixdisk_index].enabled)
+/* host level metrics follow the per disk ones */
+   if ((host_metric_count > 0) && (metric_index >= host_metric_base))
+   {
+      if ((aixdisk_count == 0) || (metric_index >= host_metric_base + host_metric_count))
+      {
+         val.uint32 = 0; /* default fallback */
+         return( val );
+      }
+
+      if (time_diff( 0, &now ) > aixdisks[0].threshold)
+         read_disks( now );
+
+      return( host_metric_func[metric_index - host_metric_base]( host_metric_arg[metric_index - host_metric_base] ) );
+   }
+
+
+/* metrics_info holds aixdisk_count entries per metric (or one packed entry
+ * per disk), so the device index follows directly from the metric index
+ */
+   if ((aixdisk_count == 0) ||
+       (metric_index >= (packed_mode ? 1 : aixdisk_metric_count) * aixdisk_count))
+   {
+      val.uint32 = 0; /* default fallback */
+      return( val );
+   }
+
+   devIndex = metric_index % aixdisk_count;
+
+   if ((! aixdisks[devIndex].enabled) && (! packed_mode)
+       && (aixdisk_metric_id[metric_index / aixdisk_count] != M_HEALTH))
    {
-      delta_t = time_diff( aixdisk_index, &now );
+      val.d = -1.0;
+      return( val );
+   }
+
+   delta_t = time_diff( devIndex, &now );
+   if (delta_t > aixdisks[devIndex].threshold)
+      read_disks( now );
 
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
+   if (packed_mode)
+      return( aixdisk_packed_func( devIndex ) );
 
-      val.d = aixdisk_wq_sampled[aixdisk_index].curr_value;
+
+/* values which did not move since they were last sent are served as is */
+   if (! DIRTY_TEST( metric_index ))
+   {
+      val.d = aixdisk_published[metric_index];
+      return( val );
    }
-   else
-      val.d = -1.0;
 
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_wq_sampled_func = %f\n", val.d ); fflush( stderr );
-#endif
 
+   val = aixdisk_value_func( metric_index / aixdisk_count, devIndex );
+
+   aixdisk_published[metric_index] = val.d;
+   DIRTY_CLEAR( metric_index );
 
    return( val );
 }
 
 
-static g_val_t
-aixdisk_wq_time_func( int aixdisk_index )
+
+static g_val_t aixdisk_metric_handler ( int metric_index )
 {
-   double delta_t,
-          now;
    g_val_t val;
 
 
-   if (aixdisks[aixdisk_index].enabled)
-   {
-      delta_t = time_diff( aixdisk_index, &now );
+   TRACE_SPAN( "callback", metric_index, val = dispatch_metric( metric_index ) );
 
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
+   return( val );
+}
 
-      val.d = aixdisk_wq_time[aixdisk_index].curr_value;
-   }
-   else
-      val.d = -1.0;
 
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_wq_time_func = %f\n", val.d ); fflush( stderr );
-#endif
 
+mmodule aixdisk_module =
+{
+   STD_MMODULE_STUFF,
+   aixdisk_metric_init,
+   aixdisk_metric_cleanup,
+   NULL, /* defined dynamically */
+   aixdisk_metric_handler
+};
 
-   return( val );
-}
 
+#ifdef STAND_ALONE
+/*
+   compile with:
 
-static g_val_t
-aixdisk_wq_min_time_func( int aixdisk_index )
-{
-   double delta_t,
-          now;
-   g_val_t val;
+xlc_r -DSTAND_ALONE -U_AIX43 -qlanglvl=extc99 -I. -I../../.. -I/opt/freeware/include/apr-1 -I../../../include -I../../../lib -I../../../libmetrics -qmaxmem=16384 -DSYSV -D_AIX -D_AIX32 -D_AIX41 -D_AIX43 -D_AIX51 -D_AIX52 -D_AIX53 -D_ALL_SOURCE -DFUNCPROTO=15 -O -I/opt/freeware/include -D_ALL_SOURCE -DAIX -DHAVE_PERFSTAT -o aixdisk_stat mod_aixdisk.c -L/opt/freeware/lib -lm -ldl -lperfstat -lcfg -lodm -lnsl -lpcre -lexpat -lconfuse -lapr-1 -lpthreads -lpthread -qmaxmem=16384 -Wl,-bmaxdata:0x80000000
 
+   or use the aixdisk_stat target of the Makefile.
 
-   if (aixdisks[aixdisk_index].enabled)
-   {
-      delta_t = time_diff( aixdisk_index, &now );
 
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
+   aixdisk_stat is an iostat like sampler on top of the module's collection
+   engine, it writes one record per selected disk and sample:
 
-      val.d = aixdisk_wq_min_time[aixdisk_index].curr_value;
-   }
-   else
-      val.d = -1.0;
+      csv   time,disk,<metric>,...  with a header line
+      json  {"time":<time>,"disk":"<disk>","<metric>":<value>,...}
+      bin   the header "AIXDSTAT", version, number of disks and metrics
+            (unsigned 32 bit each), the NUL terminated disk and metric
+            names and then per sample the time and all values of all
+            disks as doubles in host byte order
 
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_wq_min_time_func = %f\n", val.d ); fflush( stderr );
-#endif
+   The time is in seconds since the epoch.
 
+   With -H it reads the history file kept by the module (history_file
+   parameter) instead and writes the snapshots from -b to -e in the same
+   formats, times are in seconds since the epoch or, if negative, relative
+   to now.
+ */
 
-   return( val );
-}
 
+#define STAT_MIN_INTERVAL 0.1
 
-static g_val_t
-aixdisk_wq_max_time_func( int aixdisk_index )
-{
-   double delta_t,
-          now;
-   g_val_t val;
+#define STAT_BUF_SIZE 65536
 
+#define STAT_BIN_VERSION 1
 
-   if (aixdisks[aixdisk_index].enabled)
-   {
-      delta_t = time_diff( aixdisk_index, &now );
 
-      if (delta_t > aixdisks[aixdisk_index].threshold)
-         read_disk( aixdisk_index, delta_t, now );
+static volatile sig_atomic_t stat_stop = 0;
 
-      val.d = aixdisk_wq_max_time[aixdisk_index].curr_value;
-   }
-   else
-      val.d = -1.0;
+/* names of all disks and metrics of the source, the history values of the
+   current snapshot or NULL when sampling live */
+static const char **stat_disk_name = NULL;
+static const char **stat_metric_name = NULL;
+static int stat_ndisk_names = 0;
+static int stat_nmetric_names = 0;
+static const double *stat_values = NULL;
 
-#ifdef DEBUG
-fprintf( stderr, "aixdisk_wq_max_time_func = %f\n", val.d ); fflush( stderr );
-#endif
+
+static void
+stat_signal( int sig )
+{
+   stat_stop = 1;
+}
 
 
-   return( val );
+
+static void
+stat_usage( const char *prog )
+{
+   fprintf( stderr,
+            "usage: %s [-i interval] [-c count] [-o csv|json|bin] [-d disk,...] [-m metric,...] [-l]\n"
+            "       %s -H file [-b begin] [-e end] [-o csv|json|bin] [-d disk,...] [-m metric,...] [-l]\n"
+            "  -i  sampling interval in seconds, at least %.1f (default 1)\n"
+            "  -c  number of samples, 0 samples until interrupted (default 0)\n"
+            "  -o  output format (default csv)\n"
+            "  -d  disks to sample (default all)\n"
+            "  -m  metrics to sample (default all)\n"
+            "  -l  list the available disks and metrics\n"
+            "  -H  read the snapshots kept in the module's history file\n"
+            "  -b  first snapshot time, seconds since the epoch or before now if negative\n"
+            "  -e  last snapshot time, likewise (default now)\n",
+            prog, prog, STAT_MIN_INTERVAL );
 }
 
-#endif
 
 
-/* Initialize the given metric by allocating the per metric data
-   structure and inserting a metric definition for each network
-   interface found.
-*/
-static aixdisk_data_t *init_metric( apr_pool_t *p,
-                                    apr_array_header_t *ar,
-                                    int aixdisk_count,
-                                    char *name,
-                                    char *desc,
-                                    char *units )
+/* Resolve a comma separated list of names against the given name table.
+   Returns the number of indices stored or -1 for an unknown name. */
+static int
+stat_select( apr_pool_t *p,
+             const char *list,
+             const char *what,
+             int (*lookup)( const char * ),
+             int *sel,
+             int max )
 {
-   int i;
-   Ganglia_25metric *gmi;
-   aixdisk_data_t *aix_hdisk;
+   char *names,
+        *name,
+        *last;
+   int n,
+       idx;
 
 
-   aix_hdisk = apr_pcalloc( p, sizeof( aixdisk_data_t ) * aixdisk_count );
+   n = 0;
 
-   for (i = 0;  i < aixdisk_count;  i++)
+   names = apr_pstrdup( p, list );
+   for (name = apr_strtok( names, ", ", &last );
+        (name != NULL) && (n < max);
+        name = apr_strtok( NULL, ", ", &last ))
    {
-      gmi = apr_array_push( ar );
+      idx = lookup( name );
+      if (idx < 0)
+      {
+         fprintf( stderr, "unknown %s %s\n", what, name );
+         return( -1 );
+      }
 
-      /* gmi->key will be automatically assigned by gmond */
-      gmi->name = apr_psprintf( p, "%s_%s", aixdisks[i].devName, name );
-      gmi->tmax = 60;
-      gmi->type = GANGLIA_VALUE_DOUBLE;
-      gmi->units = apr_pstrdup( p, units );
-      gmi->slope = apr_pstrdup( p, "both" );
-      gmi->fmt = apr_pstrdup( p, "%.1f" );
-      gmi->msg_size = UDP_HEADER_SIZE + 16;
-      gmi->desc = apr_psprintf( p, "%s %s", aixdisks[i].devName, desc );
+      sel[n++] = idx;
    }
 
-   return( aix_hdisk);
+   return( n );
 }
 
 
 
-/*
- * Declare ourselves so the configuration routines can find and know us.
- * We'll fill it in at the end of the module.
- */
-extern mmodule aixdisk_module;
-
-
-static int aixdisk_metric_init( apr_pool_t *p )
+static int
+stat_find_disk( const char *name )
 {
    int i;
-   double now;
-   Ganglia_25metric *gmi;
-   struct vario var;
 
 
-/* Enable collection of disk input and output statistics in AIX */
+   for (i = 0;  i < stat_ndisk_names;  i++)
+      if (strcmp( name, stat_disk_name[i] ) == 0)
+         return( i );
 
-   sys_parm( SYSP_GET, SYSP_V_IOSTRUN, &var );
-   allowDiskPerfCollection = var.v.v_iostrun.value;
+   return( -1 );
+}
 
-   var.v.v_iostrun.value = 1; /* 1 to set & 0 to unset */
-   sys_parm( SYSP_SET, SYSP_V_IOSTRUN, &var );
 
 
-/* Initialize all required data and structures */
+static int
+stat_find_metric( const char *name )
+{
+   int m;
 
-   aixdisk_count = detect_aixdisk_devices();
 
+   for (m = 0;  m < stat_nmetric_names;  m++)
+      if (strcmp( name, stat_metric_name[m] ) == 0)
+         return( m );
 
-/* Allocate a pool that will be used by this module */
-   apr_pool_create( &pool, p );
+   return( -1 );
+}
 
-   metric_info = apr_array_make( pool, 2, sizeof( Ganglia_25metric ) );
 
 
-/* Initialize each metric */
-   aixdisk_size = init_metric( pool,
-                               metric_info,
-                               aixdisk_count,
-                               "size",
-                               "total disk size",
-                               "bytes" );
-   aixdisk_free = init_metric( pool,
-                               metric_info,
-                               aixdisk_count,
-                               "free",
-                               "free disk size",
-                               "bytes" );
-   aixdisk_bsize = init_metric( pool,
-                                metric_info,
-                                aixdisk_count,
-                                "bsize",
-                                "block size",
-                                "bytes" );
-   aixdisk_xrate = init_metric( pool,
-                                metric_info,
-                                aixdisk_count,
-                                "xrate",
-                                "transfer rate capability",
-                                "bytes/sec" );
-   aixdisk_xfers = init_metric( pool,
-                                metric_info,
-                                aixdisk_count,
-                                "xfers",
-                                "number of transfers to/from disk",
-                                "transfers/sec" );
-   aixdisk_wbytes = init_metric( pool,
-                                 metric_info,
-                                 aixdisk_count,
-                                 "wbytes",
-                                 "number of bytes written to disk",
-                                 "bytes" );
-   aixdisk_rbytes = init_metric( pool,
-                                 metric_info,
-                                 aixdisk_count,
-                                 "rbytes",
-                                 "number of bytes read from disk",
-                                 "bytes" );
-   aixdisk_qdepth = init_metric( pool,
-                                 metric_info,
-                                 aixdisk_count,
-                                 "qdepth",
-                                 "instantaneous service queue depth",
-                                 "" );
-   aixdisk_time = init_metric( pool,
-                               metric_info,
-                               aixdisk_count,
-                               "time",
-                               "percentage of time disk is active",
-                               "" );
-#ifdef _AIX53
-   aixdisk_q_full = init_metric( pool,
-                                 metric_info,
-                                 aixdisk_count,
-                                 "q_full",
-                                 "service queue full occurrence count",
-                                 "" );
-   aixdisk_rserv = init_metric( pool,
-                                metric_info,
-                                aixdisk_count,
-                                "rserv",
-                                "read or receive service time",
-                                "" );
-   aixdisk_rtimeout = init_metric( pool,
-                                   metric_info,
-                                   aixdisk_count,
-                                   "rtimeout",
-                                   "number of read request timeouts",
-                                   "" );
-   aixdisk_rfailed = init_metric( pool,
-                                  metric_info,
-                                  aixdisk_count,
-                                  "rfailed",
-                                  "number of failed read requests",
-                                  "" );
-   aixdisk_min_rserv = init_metric( pool,
-                                    metric_info,
-                                    aixdisk_count,
-                                    "min_rserv",
-                                    "minimum read or receive service time",
-                                    "" );
-   aixdisk_max_rserv = init_metric( pool,
-                                    metric_info,
-                                    aixdisk_count,
-                                    "max_rserv",
-                                    "maximum read or receive service time",
-                                    "" );
-   aixdisk_wserv = init_metric( pool,
-                                metric_info,
-                                aixdisk_count,
-                                "wserv",
-                                "write or send service time",
-                                "" );
-   aixdisk_wtimeout = init_metric( pool,
-                                   metric_info,
-                                   aixdisk_count,
-                                   "wtimeout",
-                                   "number of write request timeouts",
-                                   "" );
-   aixdisk_wfailed = init_metric( pool,
-                                  metric_info,
-                                  aixdisk_count,
-                                  "wfailed",
-                                  "number of failed write requests",
-                                  "" );
-   aixdisk_min_wserv = init_metric( pool,
-                                    metric_info,
-                                    aixdisk_count,
-                                    "min_wserv",
-                                    "minimum write or send service time",
-                                    "" );
-   aixdisk_max_wserv = init_metric( pool,
-                                    metric_info,
-                                    aixdisk_count,
-                                    "max_wserv",
-                                    "maximum write or send service time",
-                                    "" );
-   aixdisk_wq_depth = init_metric( pool,
-                                   metric_info,
-                                   aixdisk_count,
-                                   "wq_depth",
-                                   "instantaneous wait queue depth",
-                                   "" );
-   aixdisk_wq_sampled = init_metric( pool,
-                                     metric_info,
-                                     aixdisk_count,
-                                     "wq_sampled",
-                                     "accumulated sampled dk_wq_depth",
-                                     "" );
-   aixdisk_wq_time = init_metric( pool,
-                                  metric_info,
-                                  aixdisk_count,
-                                  "wq_time",
-                                  "accumulated wait queueing time",
-                                  "" );
-   aixdisk_wq_min_time = init_metric( pool,
-                                      metric_info,
-                                      aixdisk_count,
-                                      "wq_min_time",
-                                      "minimum wait queueing time",
-                                      "" );
-   aixdisk_wq_max_time = init_metric( pool,
-                                      metric_info,
-                                      aixdisk_count,
-                                      "wq_max_time",
-                                      "maximum wait queueing time",
-                                      "" );
-#endif
+static double
+stat_value( int m, int d )
+{
+   if (stat_values != NULL)
+      return( stat_values[m * stat_ndisk_names + d] );
 
+   return( aixdisk_metric_data[m][d].curr_value );
+}
 
-/* Add a terminator to the array and replace the empty static metric definition
-   array with the dynamic array that we just created
-*/
-   gmi = apr_array_push( metric_info );
-   memset( gmi, 0, sizeof( *gmi ));
 
-   aixdisk_module.metrics_info = (Ganglia_25metric *) metric_info->elts;
+
+static void
+stat_header( char format, const int *disks, int ndisks, const int *metrics, int nmetrics )
+{
+   unsigned int h[3];
+   int i;
 
 
-#ifndef STAND_ALONE
-   for (i = 0;  aixdisk_module.metrics_info[i].name != NULL;  i++)
+   if (format == 'c')
    {
-      /* Initialize the metadata storage for each of the metrics and then
-       *  store one or more key/value pairs.  The define MGROUPS defines
-       *  the key for the grouping attribute. */
-      MMETRIC_INIT_METADATA( &(aixdisk_module.metrics_info[i]), p );
-      MMETRIC_ADD_METADATA( &(aixdisk_module.metrics_info[i]), MGROUP, "aixdisk" );
+      fputs( "time,disk", stdout );
+      for (i = 0;  i < nmetrics;  i++)
+         printf( ",%s", stat_metric_name[metrics[i]] );
+      putchar( '\n' );
    }
-#endif
+   else if (format == 'b')
+   {
+      h[0] = STAT_BIN_VERSION;
+      h[1] = ndisks;
+      h[2] = nmetrics;
 
+      fwrite( "AIXDSTAT", 8, 1, stdout );
+      fwrite( h, sizeof( h ), 1, stdout );
 
-/* initialize the routines which require a time interval */
+      for (i = 0;  i < ndisks;  i++)
+         fwrite( stat_disk_name[disks[i]], strlen( stat_disk_name[disks[i]] ) + 1, 1, stdout );
+      for (i = 0;  i < nmetrics;  i++)
+         fwrite( stat_metric_name[metrics[i]], strlen( stat_metric_name[metrics[i]] ) + 1, 1, stdout );
+   }
+}
 
-   boottime = boottime_func_CALLED_ONCE();
-   now = get_current_time();
-   for (i = 0;  i < aixdisk_count;  i++)
-   {
-      aixdisk_size[i].curr_value = aixdisk_size[i].last_value = 0.0;
-      aixdisk_free[i].curr_value = aixdisk_free[i].last_value = 0.0;
-      aixdisk_bsize[i].curr_value = aixdisk_bsize[i].last_value = 0.0;
-      aixdisk_xrate[i].curr_value = aixdisk_xrate[i].last_value = 0.0;
-      aixdisk_xfers[i].curr_value = aixdisk_xfers[i].last_value = 0.0;
-      aixdisk_wbytes[i].curr_value = aixdisk_wbytes[i].last_value = 0.0;
-      aixdisk_rbytes[i].curr_value = aixdisk_rbytes[i].last_value = 0.0;
-      aixdisk_qdepth[i].curr_value = aixdisk_qdepth[i].last_value = 0.0;
-      aixdisk_time[i].curr_value = aixdisk_time[i].last_value = 0.0;
-#ifdef _AIX53
-      aixdisk_q_full[i].curr_value = aixdisk_q_full[i].last_value = 0.0;
-      aixdisk_rserv[i].curr_value = aixdisk_rserv[i].last_value = 0.0;
-      aixdisk_rtimeout[i].curr_value = aixdisk_rtimeout[i].last_value = 0.0;
-      aixdisk_rfailed[i].curr_value = aixdisk_rfailed[i].last_value = 0.0;
-      aixdisk_min_rserv[i].curr_value = aixdisk_min_rserv[i].last_value = 0.0;
-      aixdisk_max_rserv[i].curr_value = aixdisk_max_rserv[i].last_value = 0.0;
-      aixdisk_wserv[i].curr_value = aixdisk_wserv[i].last_value = 0.0;
-      aixdisk_wtimeout[i].curr_value = aixdisk_wtimeout[i].last_value = 0.0;
-      aixdisk_wfailed[i].curr_value = aixdisk_wfailed[i].last_value = 0.0;
-      aixdisk_min_wserv[i].curr_value = aixdisk_min_wserv[i].last_value = 0.0;
-      aixdisk_max_wserv[i].curr_value = aixdisk_max_wserv[i].last_value = 0.0;
-      aixdisk_wq_depth[i].curr_value = aixdisk_wq_depth[i].last_value = 0.0;
-      aixdisk_wq_sampled[i].curr_value = aixdisk_wq_sampled[i].last_value = 0.0;
-      aixdisk_wq_time[i].curr_value = aixdisk_wq_time[i].last_value = 0.0;
-      aixdisk_wq_min_time[i].curr_value = aixdisk_wq_min_time[i].last_value = 0.0;
-      aixdisk_wq_max_time[i].curr_value = aixdisk_wq_max_time[i].last_value = 0.0;
-
-      read_disk( i, 1.0, now );
 
-      sleep( 1 );
-      now += 1.0;
 
-      read_disk( i, 1.0, now );
-#endif
+/* Print a value with as many digits as it takes to read it back exactly,
+   byte counters and sizes are not rounded.  Values which are not finite
+   are null in JSON and empty in CSV. */
+static void
+stat_print_value( char format, double v )
+{
+   char buf[32];
+
+
+   if (! isfinite( v ))
+   {
+      if (format == 'j')
+         fputs( "null", stdout );
+      return;
    }
 
+   snprintf( buf, sizeof( buf ), "%.15g", v );
+   if (strtod( buf, NULL ) != v)
+      snprintf( buf, sizeof( buf ), "%.17g", v );
 
-/* return OK */
-   return( 0 );
+   fputs( buf, stdout );
 }
 
 
 
-static void aixdisk_metric_cleanup ( void )
+static void
+stat_sample( char format, double t, const int *disks, int ndisks, const int *metrics, int nmetrics )
 {
-   struct vario var;
+   double v;
+   int i,
+       j;
 
 
-/* set old value again */
-   var.v.v_iostrun.value = allowDiskPerfCollection;
-   sys_parm( SYSP_SET, SYSP_V_IOSTRUN, &var );
-}
+   if (format == 'b')
+   {
+      fwrite( &t, sizeof( t ), 1, stdout );
 
+      for (i = 0;  i < ndisks;  i++)
+         for (j = 0;  j < nmetrics;  j++)
+         {
+            v = stat_value( metrics[j], disks[i] );
+            fwrite( &v, sizeof( v ), 1, stdout );
+         }
 
+      return;
+   }
 
-static g_val_t aixdisk_metric_handler ( int metric_index )
-{
-   g_val_t val;
-   char *p,
-         name[256];
-   int i, devIndex; 
+   for (i = 0;  i < ndisks;  i++)
+   {
+      if (format == 'c')
+      {
+         printf( "%.3f,%s", t, stat_disk_name[disks[i]] );
+         for (j = 0;  j < nmetrics;  j++)
+         {
+            putchar( ',' );
+            stat_print_value( format, stat_value( metrics[j], disks[i] ) );
+         }
+         putchar( '\n' );
+      }
+      else
+      {
+         printf( "{\"time\":%.3f,\"disk\":\"%s\"", t, stat_disk_name[disks[i]] );
+         for (j = 0;  j < nmetrics;  j++)
+         {
+            printf( ",\"%s\":", stat_metric_name[metrics[j]] );
+            stat_print_value( format, stat_value( metrics[j], disks[i] ) );
+         }
+         fputs( "}\n", stdout );
+      }
+   }
+}
 
 
-/* Get the metric name and device index from the combined name that was
- * passed in
- */
-   strcpy( name, aixdisk_module.metrics_info[metric_index].name );
 
-   p = index( name, '_' ) + 1;
-   name[p - name - 1] = '\0';
+/* Write the snapshots of the history file taken from begin to end */
+static void
+stat_history( apr_pool_t *p, aixdisk_shm_t *shm, char format, double begin, double end,
+              const int *disks, int ndisks, const int *metrics, int nmetrics )
+{
+   unsigned long long latest,
+                      seq;
+   double *values,
+          t;
+   int nvalues;
 
 
-/* now we need to match the name with the name of all found disk devices */
-   devIndex = -1;
+   nvalues = stat_ndisk_names * stat_nmetric_names;
+   values = apr_palloc( p, sizeof( double ) * NONZERO( nvalues ) );
+   stat_values = values;
 
-   for (i = 0;  i < aixdisk_count;  i++)
-     if (strcmp( name, aixdisks[i].devName ) == 0)
-     {
-        devIndex = i;
-        break;
-     }
+   latest = aixdisk_shm_latest( shm );
+   seq = (latest > aixdisk_shm_nslots( shm )) ? latest - aixdisk_shm_nslots( shm ) + 1 : 1;
 
-   if (devIndex == -1)
+   for (;  (seq <= latest) && (! stat_stop);  seq++)
    {
-      val.uint32 = 0; /* default fallback */
-      return( val );
+/* a snapshot the module overwrote meanwhile is skipped */
+      if (aixdisk_shm_read( shm, seq, &t, values ) != 0)
+         continue;
+
+      if ((t >= begin) && (t <= end))
+         stat_sample( format, t, disks, ndisks, metrics, nmetrics );
    }
+}
 
 
-/* jump into the right function */
 
-   if (strcmp( p, "size" ) == 0)
-      return( aixdisk_size_func( devIndex ) );
+static void
+stat_close( aixdisk_shm_t *shm )
+{
+   if (shm != NULL)
+      aixdisk_shm_close( shm );
+   else
+      aixdisk_metric_cleanup();
+}
 
-   if (strcmp( p, "free" ) == 0)
-      return( aixdisk_free_func( devIndex ) );
 
-   if (strcmp( p, "bsize" ) == 0)
-      return( aixdisk_bsize_func( devIndex ) );
 
-   if (strcmp( p, "xrate" ) == 0)
-      return( aixdisk_xrate_func( devIndex ) );
+int main( int argc, char *argv[] )
+{
+   double interval,
+          now,
+          next,
+          wait,
+          begin,
+          end;
+   long count,
+        n;
+   char format;
+   const char *disk_list,
+              *metric_list,
+              *history;
+   int *disks,
+       *metrics,
+       ndisks,
+       nmetrics,
+       list,
+       opt,
+       i;
+   struct timeval tv;
+   struct timespec ts;
+   aixdisk_shm_t *shm;
+   apr_pool_t *p;
 
-   if (strcmp( p, "xfers" ) == 0)
-      return( aixdisk_xfers_func( devIndex ) );
 
-   if (strcmp( p, "xrate" ) == 0)
-      return( aixdisk_xrate_func( devIndex ) );
+   interval = 1.0;
+   count = 0;
+   format = 'c';
+   disk_list = NULL;
+   metric_list = NULL;
+   list = FALSE;
+   history = NULL;
+   begin = 0.0;
+   end = 0.0;
+   shm = NULL;
 
-   if (strcmp( p, "wbytes" ) == 0)
-      return( aixdisk_wbytes_func( devIndex ) );
+   while ((opt = getopt( argc, argv, "i:c:o:d:m:lH:b:e:h" )) != -1)
+   {
+      switch (opt)
+      {
+         case 'i':
+            interval = atof( optarg );
+            break;
 
-   if (strcmp( p, "rbytes" ) == 0)
-      return( aixdisk_rbytes_func( devIndex ) );
+         case 'c':
+            count = atol( optarg );
+            break;
 
-   if (strcmp( p, "qdepth" ) == 0)
-      return( aixdisk_qdepth_func( devIndex ) );
+         case 'o':
+            if (strcmp( optarg, "csv" ) == 0)
+               format = 'c';
+            else if (strcmp( optarg, "json" ) == 0)
+               format = 'j';
+            else if (strcmp( optarg, "bin" ) == 0)
+               format = 'b';
+            else
+            {
+               stat_usage( argv[0] );
+               return( 1 );
+            }
+            break;
 
-   if (strcmp( p, "time" ) == 0)
-      return( aixdisk_time_func( devIndex ) );
+         case 'd':
+            disk_list = optarg;
+            break;
 
-#ifdef _AIX53
-   if (strcmp( p, "q_full" ) == 0)
-      return( aixdisk_q_full_func( devIndex ) );
+         case 'm':
+            metric_list = optarg;
+            break;
 
-   if (strcmp( p, "rserv" ) == 0)
-      return( aixdisk_rserv_func( devIndex ) );
+         case 'l':
+            list = TRUE;
+            break;
 
-   if (strcmp( p, "rtimeout" ) == 0)
-      return( aixdisk_rtimeout_func( devIndex ) );
+         case 'H':
+            history = optarg;
+            break;
 
-   if (strcmp( p, "rfailed" ) == 0)
-      return( aixdisk_rfailed_func( devIndex ) );
+         case 'b':
+            begin = atof( optarg );
+            break;
 
-   if (strcmp( p, "min_rserv" ) == 0)
-      return( aixdisk_min_rserv_func( devIndex ) );
+         case 'e':
+            end = atof( optarg );
+            break;
 
-   if (strcmp( p, "max_rserv" ) == 0)
-      return( aixdisk_max_rserv_func( devIndex ) );
+         default:
+            stat_usage( argv[0] );
+            return( 1 );
+      }
+   }
 
-   if (strcmp( p, "wserv" ) == 0)
-      return( aixdisk_wserv_func( devIndex ) );
+   if (interval < STAT_MIN_INTERVAL)
+      interval = STAT_MIN_INTERVAL;
 
-   if (strcmp( p, "wtimeout" ) == 0)
-      return( aixdisk_wtimeout_func( devIndex ) );
 
-   if (strcmp( p, "wfailed" ) == 0)
-      return( aixdisk_wfailed_func( devIndex ) );
+   apr_initialize();
+   apr_pool_create( &p, NULL );
 
-   if (strcmp( p, "min_wserv" ) == 0)
-      return( aixdisk_min_wserv_func( devIndex ) );
+/* the names come from the history file or from the live collection */
+   if (history != NULL)
+   {
+      shm = aixdisk_shm_open_file( history );
+      if (shm == NULL)
+      {
+         fprintf( stderr, "cannot open history file %s\n", history );
+         return( 2 );
+      }
 
-   if (strcmp( p, "max_wserv" ) == 0)
-      return( aixdisk_max_wserv_func( devIndex ) );
+      stat_ndisk_names = aixdisk_shm_ndisks( shm );
+      stat_nmetric_names = aixdisk_shm_nmetrics( shm );
 
-   if (strcmp( p, "wq_depth" ) == 0)
-      return( aixdisk_wq_depth_func( devIndex ) );
+      stat_disk_name = apr_palloc( p, sizeof( char * ) * NONZERO( stat_ndisk_names ) );
+      for (i = 0;  i < stat_ndisk_names;  i++)
+         stat_disk_name[i] = aixdisk_shm_disk_name( shm, i );
 
-   if (strcmp( p, "wq_sampled" ) == 0)
-      return( aixdisk_wq_sampled_func( devIndex ) );
+      stat_metric_name = apr_palloc( p, sizeof( char * ) * NONZERO( stat_nmetric_names ) );
+      for (i = 0;  i < stat_nmetric_names;  i++)
+         stat_metric_name[i] = aixdisk_shm_metric_name( shm, i );
+   }
+   else
+   {
+      if (aixdisk_metric_init( p ) != 0)
+         return( 2 );
 
-   if (strcmp( p, "wq_time" ) == 0)
-      return( aixdisk_wq_time_func( devIndex ) );
+      stat_ndisk_names = aixdisk_count;
+      stat_nmetric_names = aixdisk_metric_count;
 
-   if (strcmp( p, "wq_min_time" ) == 0)
-      return( aixdisk_wq_min_time_func( devIndex ) );
+      stat_disk_name = apr_palloc( p, sizeof( char * ) * NONZERO( stat_ndisk_names ) );
+      for (i = 0;  i < stat_ndisk_names;  i++)
+         stat_disk_name[i] = aixdisks[i].devName;
 
-   if (strcmp( p, "wq_max_time" ) == 0)
-      return( aixdisk_wq_max_time_func( devIndex ) );
-#endif
+      stat_metric_name = aixdisk_metric_name;
+   }
 
-   val.uint32 = 0; /* default fallback */
-   return( val );
-}
+   if (list)
+   {
+      for (i = 0;  i < stat_ndisk_names;  i++)
+         printf( "disk   %s\n", stat_disk_name[i] );
+      for (i = 0;  i < stat_nmetric_names;  i++)
+         printf( "metric %s\n", stat_metric_name[i] );
 
+      stat_close( shm );
+      return( 0 );
+   }
 
 
-mmodule aixdisk_module =
-{
-   STD_MMODULE_STUFF,
-   aixdisk_metric_init,
-   aixdisk_metric_cleanup,
-   NULL, /* defined dynamically */
-   aixdisk_metric_handler
-};
+/* resolve the disk and metric selection once */
+   disks = apr_palloc( p, sizeof( int ) * NONZERO( stat_ndisk_names ) );
+   metrics = apr_palloc( p, sizeof( int ) * NONZERO( stat_nmetric_names ) );
 
+   if (disk_list != NULL)
+      ndisks = stat_select( p, disk_list, "disk", stat_find_disk, disks, stat_ndisk_names );
+   else
+      for (ndisks = 0;  ndisks < stat_ndisk_names;  ndisks++)
+         disks[ndisks] = ndisks;
 
-#ifdef STAND_ALONE
-/*
-   compile with:
+   if (metric_list != NULL)
+      nmetrics = stat_select( p, metric_list, "metric", stat_find_metric, metrics, stat_nmetric_names );
+   else
+      for (nmetrics = 0;  nmetrics < stat_nmetric_names;  nmetrics++)
+         metrics[nmetrics] = nmetrics;
 
-xlc_r -DSTAND_ALONE -DDEBUG -U_AIX43 -qlanglvl=extc99 -I. -I../../.. -I/opt/freeware/include/apr-1 -I../../../include -I../../../lib -I../../../libmetrics -qmaxmem=16384 -DSYSV -D_AIX -D_AIX32 -D_AIX41 -D_AIX43 -D_AIX51 -D_AIX52 -D_AIX53 -D_ALL_SOURCE -DFUNCPROTO=15 -O -I/opt/freeware/include -D_ALL_SOURCE -DAIX -DHAVE_PERFSTAT -o aixdisk_test mod_aixdisk.c -L/opt/freeware/lib -lm -ldl -lperfstat -lcfg -lodm -lnsl -lpcre -lexpat -lconfuse -lapr-1 -lpthreads -lpthread -qmaxmem=16384 -Wl,-bmaxdata:0x80000000
+   if ((ndisks < 0) || (nmetrics < 0))
+   {
+      stat_close( shm );
+      return( 1 );
+   }
 
 
+   signal( SIGINT, stat_signal );
+   signal( SIGTERM, stat_signal );
 
- */
+/* one write per sample at most */
+   setvbuf( stdout, NULL, _IOFBF, STAT_BUF_SIZE );
 
+   stat_header( format, disks, ndisks, metrics, nmetrics );
 
-int main( int argc, char *argv[] )
-{
-   int i;
-   double now;
-   apr_pool_t *p;
+   if (shm != NULL)
+   {
+      gettimeofday( &tv, NULL );
+      now = tv.tv_sec + tv.tv_usec / 1000000.0;
+      if (begin < 0.0)
+         begin += now;
+      if (end <= 0.0)
+         end += now;
 
+      stat_history( p, shm, format, begin, end, disks, ndisks, metrics, nmetrics );
 
-   now = get_current_time();
+      fflush( stdout );
+      stat_close( shm );
+      return( 0 );
+   }
 
-   aixdisk_metric_init( p );
 
-   sleep( 2.0 ) ;
-   now += 2.0;
+/* samples are taken on a fixed schedule so the interval does not drift */
+   next = get_current_time();
 
-   for (i = 0;  i < aixdisk_count;  i++)
+   for (n = 0;  ((count == 0) || (n < count)) && (! stat_stop);  n++)
    {
-      read_disk( i, 2.0, now );
-   }
+      next += interval;
 
-   sleep( 2.0 ) ;
-   now += 2.0;
+      now = get_current_time();
+      wait = next - now;
+      if (wait < 0.0)
+      {
+         /* overrun, continue with the next due slot */
+         next = now;
+         wait = 0.0;
+      }
 
-   for (i = 0;  i < aixdisk_count;  i++)
-   {
-      read_disk( i, 2.0, now );
+      ts.tv_sec = (time_t) wait;
+      ts.tv_nsec = (long) ((wait - ts.tv_sec) * 1000000000.0);
+      if ((nanosleep( &ts, NULL ) != 0) && stat_stop)
+         break;
+
+      now = get_current_time();
+      read_disks( now );
+
+      gettimeofday( &tv, NULL );
+      stat_sample( format, tv.tv_sec + tv.tv_usec / 1000000.0,
+                   disks, ndisks, metrics, nmetrics );
+
+      fflush( stdout );
    }
+
+   aixdisk_metric_cleanup();
+
+   return( 0 );
 }
 #endif
-
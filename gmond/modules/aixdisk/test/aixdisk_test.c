@@ -0,0 +1,180 @@
+/******************************************************************************
+ *
+ *  Helpers of the aixdisk tests, see aixdisk_test.h.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <gm_metric.h>
+#include <apr_general.h>
+#include <apr_tables.h>
+#include <apr_strings.h>
+
+#include "aixdisk_test.h"
+
+
+extern mmodule aixdisk_module;
+
+
+static apr_pool_t *test_pool = NULL;
+
+static int test_checks = 0;
+static int test_failures = 0;
+
+
+void
+test_check( int ok, const char *what, const char *file, int line )
+{
+   test_checks++;
+
+   if (! ok)
+   {
+      test_failures++;
+      fprintf( stderr, "%s:%d: check failed: %s\n", file, line, what );
+   }
+}
+
+
+
+void
+test_near( double v, double want, double eps, const char *what, const char *file, int line )
+{
+   test_checks++;
+
+   if (! (fabs( v - want ) <= eps))
+   {
+      test_failures++;
+      fprintf( stderr, "%s:%d: %s is %.9g, expected %.9g\n", file, line, what, v, want );
+   }
+}
+
+
+
+static apr_pool_t *
+test_get_pool( void )
+{
+   if (test_pool == NULL)
+   {
+      apr_initialize();
+      apr_pool_create( &test_pool, NULL );
+   }
+
+   return( test_pool );
+}
+
+
+
+void
+test_param( const char *name, const char *value )
+{
+   mmparam *mp;
+
+
+   if (aixdisk_module.module_params_list == NULL)
+      aixdisk_module.module_params_list = apr_array_make( test_get_pool(), 8, sizeof( mmparam ) );
+
+   mp = (mmparam *) apr_array_push( aixdisk_module.module_params_list );
+   mp->name = apr_pstrdup( test_get_pool(), name );
+   mp->value = apr_pstrdup( test_get_pool(), value );
+}
+
+
+
+int
+test_init( int ndisks )
+{
+   fake_setup( ndisks );
+
+   return( aixdisk_module.init( test_get_pool() ) );
+}
+
+
+
+int
+test_metric( const char *name )
+{
+   int i;
+
+
+   for (i = 0;  aixdisk_module.metrics_info[i].name != NULL;  i++)
+      if (strcmp( aixdisk_module.metrics_info[i].name, name ) == 0)
+         return( i );
+
+   return( -1 );
+}
+
+
+
+double
+test_value( const char *name )
+{
+   g_val_t val;
+   int i;
+
+
+   i = test_metric( name );
+   if (i < 0)
+      return( NAN );
+
+   val = aixdisk_module.handler( i );
+
+   switch (aixdisk_module.metrics_info[i].type)
+   {
+      case GANGLIA_VALUE_DOUBLE:
+         return( val.d );
+      case GANGLIA_VALUE_FLOAT:
+         return( val.f );
+      case GANGLIA_VALUE_UNSIGNED_INT:
+         return( val.uint32 );
+      case GANGLIA_VALUE_INT:
+         return( val.int32 );
+      default:
+         return( NAN );
+   }
+}
+
+
+
+void
+test_collect( void )
+{
+   int i;
+
+
+   for (i = 0;  aixdisk_module.metrics_info[i].name != NULL;  i++)
+      aixdisk_module.handler( i );
+}
+
+
+
+void
+test_cycle( int seconds )
+{
+   fake_run( seconds );
+
+   test_collect();
+}
+
+
+
+int
+test_report( void )
+{
+   if (test_failures > 0)
+      fprintf( stderr, "%d of %d checks failed\n", test_failures, test_checks );
+
+   return( (test_failures > 0) ? 1 : 0 );
+}
+
+
+
+int
+test_done( void )
+{
+   aixdisk_module.cleanup();
+
+   return( test_report() );
+}
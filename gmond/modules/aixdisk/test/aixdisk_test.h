@@ -0,0 +1,58 @@
+/******************************************************************************
+ *
+ *  Helpers of the aixdisk tests.  A test includes the module source
+ *  (so it can look at its static state) and then this file, and runs the
+ *  module on the fake libperfstat of fake_perfstat.c the way gmond would:
+ *
+ *     test_param( "collect_deadline", "0.5" );
+ *     test_init( 4 );
+ *     test_cycle( 15 );
+ *     TEST_NEAR( test_value( "hdisk0_xfers" ), 30.0, 1e-9 );
+ *     return( test_done() );
+ *
+ *  The module keeps its state in static variables and can only be
+ *  initialized once per process.  The helpers are in aixdisk_test.c.
+ *
+ ******************************************************************************/
+
+#ifndef AIXDISK_TEST_H
+#define AIXDISK_TEST_H
+
+#include "fake_perfstat.h"
+
+
+#define TEST_CHECK(c) \
+   test_check( (c) != 0, #c, __FILE__, __LINE__ )
+
+#define TEST_NEAR(v, want, eps) \
+   test_near( (v), (want), (eps), #v, __FILE__, __LINE__ )
+
+
+void test_check( int ok, const char *what, const char *file, int line );
+void test_near( double v, double want, double eps, const char *what, const char *file, int line );
+
+/* Set a module parameter, before test_init() */
+void test_param( const char *name, const char *value );
+
+/* Serve ndisks disks and initialize the module on them */
+int test_init( int ndisks );
+
+/* Index of the metric in metrics_info, -1 if it is not registered */
+int test_metric( const char *name );
+
+/* Value of the metric as gmond would get it now, NAN if there is none */
+double test_value( const char *name );
+
+/* Collect every metric, as gmond does once per cycle */
+void test_collect( void );
+
+/* Let seconds of the fake workload pass and collect every metric */
+void test_cycle( int seconds );
+
+/* Report the failed checks, returns the exit code of the test */
+int test_report( void );
+
+/* Clean up the module and report */
+int test_done( void );
+
+#endif
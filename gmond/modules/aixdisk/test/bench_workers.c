@@ -0,0 +1,116 @@
+/* Collection latency against the number of collection workers, on a fake
+   libperfstat which takes a fixed time per disk record.
+
+   usage: bench_workers [disks [us per record [rounds]]] */
+
+#include "../mod_aixdisk.c"
+#include "aixdisk_test.h"
+
+#include <sys/wait.h>
+
+
+#define DISKS 10000
+#define RECORD_US 10
+#define ROUNDS 5
+
+
+static double
+seconds( const struct timespec *a, const struct timespec *b )
+{
+   return( (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9 );
+}
+
+
+
+/* Average time of one cycle with the given workers */
+static int
+measure( int workers, int disks, int record_us, int rounds, double *latency )
+{
+   struct timespec a,
+                   b;
+   char value[16];
+   char name[64];
+   int r;
+
+
+   snprintf( value, sizeof( value ), "%d", workers );
+   test_param( "collect_workers", value );
+   test_init( disks );
+
+   fake_record_us = record_us;
+   *latency = 0.0;
+
+   for (r = 0;  r < rounds;  r++)
+   {
+      fake_run( 15 );
+
+      clock_gettime( CLOCK_MONOTONIC, &a );
+      read_disks( get_current_time() );
+      clock_gettime( CLOCK_MONOTONIC, &b );
+
+      *latency += seconds( &a, &b ) / rounds;
+   }
+
+/* the ranges of the workers are merged into the right disks */
+   fake_record_us = 0;
+   snprintf( name, sizeof( name ), "hdisk%d_xfers", disks - 1 );
+   TEST_NEAR( test_value( name ), 30.0 * disks, 1e-6 );
+   TEST_NEAR( test_value( "hdisk0_xfers" ), 30.0, 1e-6 );
+
+   return( test_done() );
+}
+
+
+
+int
+main( int argc, char *argv[] )
+{
+   const int workers[] = { 1, 2, 4, 8, 16 };
+   int disks = (argc > 1) ? atoi( argv[1] ) : DISKS,
+       record_us = (argc > 2) ? atoi( argv[2] ) : RECORD_US,
+       rounds = (argc > 3) ? atoi( argv[3] ) : ROUNDS,
+       fd[2],
+       status,
+       failed = 0,
+       w;
+   double latency,
+          serial = 0.0;
+   pid_t pid;
+
+
+   printf( "%d disks, %d us per record, %d rounds\n", disks, record_us, rounds );
+   printf( "%8s %12s %8s\n", "workers", "latency ms", "speedup" );
+
+/* the module is initialized once per process */
+   for (w = 0;  w < 5;  w++)
+   {
+      if (pipe( fd ) != 0)
+         return( 1 );
+
+      pid = fork();
+      if (pid == 0)
+      {
+         status = measure( workers[w], disks, record_us, rounds, &latency );
+         if (write( fd[1], &latency, sizeof( latency ) ) != sizeof( latency ))
+            status = 1;
+         _exit( status );
+      }
+
+      close( fd[1] );
+      if (read( fd[0], &latency, sizeof( latency ) ) != sizeof( latency ))
+         latency = 0.0;
+      close( fd[0] );
+
+      if ((pid < 0) || (waitpid( pid, &status, 0 ) != pid)
+          || ! WIFEXITED( status ) || (WEXITSTATUS( status ) != 0))
+         failed = 1;
+
+      if (w == 0)
+         serial = latency;
+
+      printf( "%8d %12.1f %8.2f\n", workers[w], latency * 1000.0,
+              (latency > 0.0) ? serial / latency : 0.0 );
+   }
+
+   return( failed );
+}
@@ -0,0 +1,273 @@
+/******************************************************************************
+ *
+ *  Fake libperfstat for the aixdisk tests, see fake_perfstat.h.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include <libperfstat.h>
+#include <sys/var.h>
+#include <sys/systemcfg.h>
+
+#include "fake_perfstat.h"
+
+
+struct sysconf _system_configuration = { 1, 1 };
+
+perfstat_disk_t fake_disk[FAKE_MAX_DISKS];
+int fake_ndisks = 0;
+char fake_gone[FAKE_MAX_DISKS];
+int fake_ncpus = 4;
+int fake_max_size = 0;
+volatile unsigned int fake_stall_us = 0;
+unsigned int fake_record_us = 0;
+volatile long fake_calls = 0;
+volatile time_t fake_now = 0;
+
+static int fake_iostrun = 0;
+static unsigned long long fake_weight[FAKE_MAX_DISKS];
+
+static pthread_mutex_t fake_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+void
+fake_setup( int ndisks )
+{
+   int i;
+
+
+   if (ndisks > FAKE_MAX_DISKS)
+      ndisks = FAKE_MAX_DISKS;
+
+   memset( fake_disk, 0, sizeof( fake_disk ) );
+   memset( fake_gone, 0, sizeof( fake_gone ) );
+
+   for (i = 0;  i < ndisks;  i++)
+   {
+      snprintf( fake_disk[i].name, IDENTIFIER_LENGTH, "hdisk%d", i );
+      snprintf( fake_disk[i].vgname, IDENTIFIER_LENGTH, "%s", (i < 2) ? "rootvg" : "datavg" );
+      fake_disk[i].size = 1000 + i;
+      fake_disk[i].free = 500;
+      fake_disk[i].bsize = 512;
+      fake_disk[i].qdepth = 3;
+      fake_disk[i].min_rserv = 100000;
+      fake_disk[i].max_rserv = 9000000;
+      fake_disk[i].wq_depth = 1;
+      fake_weight[i] = i + 1;
+   }
+
+   fake_ndisks = ndisks;
+
+   if (fake_now == 0)
+      fake_now = time( NULL );
+}
+
+
+
+void
+fake_insert( int pos, const char *name )
+{
+   if ((fake_ndisks == FAKE_MAX_DISKS) || (pos < 0) || (pos > fake_ndisks))
+      return;
+
+   memmove( &fake_disk[pos + 1], &fake_disk[pos], (fake_ndisks - pos) * sizeof( fake_disk[0] ) );
+   memmove( &fake_gone[pos + 1], &fake_gone[pos], fake_ndisks - pos );
+   memmove( &fake_weight[pos + 1], &fake_weight[pos], (fake_ndisks - pos) * sizeof( fake_weight[0] ) );
+
+   memset( &fake_disk[pos], 0, sizeof( fake_disk[0] ) );
+   snprintf( fake_disk[pos].name, IDENTIFIER_LENGTH, "%s", name );
+   snprintf( fake_disk[pos].vgname, IDENTIFIER_LENGTH, "datavg" );
+   fake_disk[pos].size = 1000;
+   fake_disk[pos].free = 500;
+   fake_disk[pos].bsize = 512;
+   fake_disk[pos].qdepth = 3;
+   fake_disk[pos].min_rserv = 100000;
+   fake_disk[pos].max_rserv = 9000000;
+   fake_disk[pos].wq_depth = 1;
+   fake_gone[pos] = 0;
+   fake_weight[pos] = 1;
+
+   fake_ndisks++;
+}
+
+
+
+void
+fake_run( int seconds )
+{
+   perfstat_disk_t *d;
+   unsigned long long k,
+                      s = seconds;
+   int i;
+
+
+   for (i = 0;  i < fake_ndisks;  i++)
+   {
+      d = &fake_disk[i];
+      k = fake_weight[i];
+
+      d->xfers += s * 30 * k;
+      d->xrate += s * 10 * k;
+      d->rblks += s * 80 * k;
+      d->wblks += s * 160 * k;
+      d->time += s * 50;
+      d->rserv += s * 2000000ULL * k;
+      d->wserv += s * 3000000ULL * k;
+      d->wq_sampled += s * 200;
+      d->wq_time += s * 1000000ULL * k;
+      d->q_full += s;
+   }
+
+   fake_now += seconds;
+}
+
+
+
+static void
+fake_delay( unsigned long us )
+{
+   struct timespec ts;
+
+
+   ts.tv_sec = us / 1000000;
+   ts.tv_nsec = (long) (us % 1000000) * 1000;
+
+   while ((nanosleep( &ts, &ts ) != 0) && (errno == EINTR))
+      ;
+}
+
+
+
+static int
+fake_find( const char *name )
+{
+   int i;
+
+
+   if (name[0] == '\0')
+      return( 0 );
+
+/* disks are found by name in list order, hdisk<i> usually sits at i */
+   if ((sscanf( name, "hdisk%d", &i ) != 1) || (i < 0) || (i >= fake_ndisks)
+       || (strcmp( fake_disk[i].name, name ) != 0))
+   {
+      for (i = 0;  i < fake_ndisks;  i++)
+         if (strcmp( fake_disk[i].name, name ) == 0)
+            break;
+   }
+
+   if ((i >= fake_ndisks) || fake_gone[i])
+      return( -1 );
+
+   return( i );
+}
+
+
+
+/* Like libperfstat: a NULL buffer asks for the number of disks, else up to
+   desired_number records from the disk named by name on are copied and
+   name is set to the next disk */
+int
+perfstat_disk( perfstat_id_t *name, perfstat_disk_t *userbuff, int sizeof_struct, int desired_number )
+{
+   int i,
+       n;
+
+
+   if ((fake_max_size > 0) && (sizeof_struct > fake_max_size))
+   {
+      errno = EINVAL;
+      return( -1 );
+   }
+
+   if (userbuff == NULL)
+   {
+      for (i = 0, n = 0;  i < fake_ndisks;  i++)
+         if (! fake_gone[i])
+            n++;
+
+      return( n );
+   }
+
+   i = fake_find( name->name );
+   if (i < 0)
+   {
+      errno = EINVAL;
+      return( -1 );
+   }
+
+   if (fake_stall_us > 0)
+      fake_delay( fake_stall_us );
+
+   for (n = 0;  (n < desired_number) && (i < fake_ndisks);  i++)
+   {
+      if (fake_gone[i])
+         continue;
+
+      memcpy( (char *) userbuff + (size_t) n * sizeof_struct, &fake_disk[i], sizeof_struct );
+      n++;
+   }
+
+   if (fake_record_us > 0)
+      fake_delay( (unsigned long) fake_record_us * n );
+
+   if (i < fake_ndisks)
+      strcpy( name->name, fake_disk[i].name );
+   else
+      name->name[0] = '\0';
+
+   pthread_mutex_lock( &fake_lock );
+   fake_calls++;
+   pthread_mutex_unlock( &fake_lock );
+
+   return( n );
+}
+
+
+
+int
+perfstat_cpu( perfstat_id_t *name, perfstat_cpu_t *userbuff, int sizeof_struct, int desired_number )
+{
+   return( fake_ncpus );
+}
+
+
+
+int
+sys_parm( int cmd, int parmflag, struct vario *parmp )
+{
+   if (cmd == SYSP_GET)
+      parmp->v.v_iostrun.value = fake_iostrun;
+   else
+      fake_iostrun = parmp->v.v_iostrun.value;
+
+   return( 0 );
+}
+
+
+
+int
+gettimeofday( struct timeval *tv, void *tz )
+{
+   tv->tv_sec = fake_now;
+   tv->tv_usec = 0;
+
+   return( 0 );
+}
+
+
+
+unsigned int
+sleep( unsigned int seconds )
+{
+   fake_now += seconds;
+
+   return( 0 );
+}
@@ -0,0 +1,62 @@
+/******************************************************************************
+ *
+ *  Fake libperfstat for the aixdisk tests.
+ *
+ *  The tests set the counters of every disk in fake_disk[] directly or let
+ *  fake_run() add a fixed workload, and steer the clock, the CPUs, the
+ *  tick conversion (_system_configuration) and the failures of the calls
+ *  through the variables below.  gettimeofday() and sleep() follow
+ *  fake_now, so a cycle of the module costs no real time.
+ *
+ ******************************************************************************/
+
+#ifndef FAKE_PERFSTAT_H
+#define FAKE_PERFSTAT_H
+
+#include <time.h>
+
+#include <libperfstat.h>
+#include <sys/systemcfg.h>
+
+
+#define FAKE_MAX_DISKS 16384
+
+
+/* records served by perfstat_disk() in list order, disk i is hdisk<i>
+   unless disks were inserted */
+extern perfstat_disk_t fake_disk[FAKE_MAX_DISKS];
+extern int fake_ndisks;
+
+/* disks left out of every answer, as if they were removed */
+extern char fake_gone[FAKE_MAX_DISKS];
+
+/* CPUs reported by perfstat_cpu() */
+extern int fake_ncpus;
+
+/* largest perfstat_disk_t size accepted, 0 = all, e.g.
+   offsetof( perfstat_disk_t, q_full ) for a level before AIX 5.3 */
+extern int fake_max_size;
+
+/* real time spent in every perfstat_disk() call and per record */
+extern volatile unsigned int fake_stall_us;
+extern unsigned int fake_record_us;
+
+/* number of perfstat_disk() calls which returned records */
+extern volatile long fake_calls;
+
+/* seconds since the epoch seen by the module */
+extern volatile time_t fake_now;
+
+
+/* Serve ndisks idle disks hdisk0 .. hdisk<ndisks-1> */
+void fake_setup( int ndisks );
+
+/* Add the idle disk name at position pos of the list, with the base
+   workload.  The disks from pos on move up one position. */
+void fake_insert( int pos, const char *name );
+
+/* Let seconds pass, with disk i of the setup doing (i + 1) times the base workload of
+   30 transfers (10 reads) and 50 percent busy per second */
+void fake_run( int seconds );
+
+#endif
@@ -0,0 +1,67 @@
+/******************************************************************************
+ *
+ *  Stand-in for the AIX <libperfstat.h> of the aixdisk tests, it declares
+ *  only what mod_aixdisk uses.  perfstat_disk_t keeps the field order of
+ *  AIX 5.3, q_full starts the extended part and q_sampled ends the 5.3
+ *  structure, a later level follows.  The functions are in
+ *  fake_perfstat.c.
+ *
+ ******************************************************************************/
+
+#ifndef FAKE_LIBPERFSTAT_H
+#define FAKE_LIBPERFSTAT_H
+
+
+typedef unsigned long long u_longlong_t;
+
+#define IDENTIFIER_LENGTH 64
+
+
+typedef struct {
+   char name[IDENTIFIER_LENGTH];
+} perfstat_id_t;
+
+typedef struct {
+   char name[IDENTIFIER_LENGTH];
+   char description[IDENTIFIER_LENGTH];
+   char vgname[IDENTIFIER_LENGTH];
+   u_longlong_t size;
+   u_longlong_t free;
+   u_longlong_t bsize;
+   u_longlong_t xrate;
+   u_longlong_t xfers;
+   u_longlong_t wblks;
+   u_longlong_t rblks;
+   u_longlong_t qdepth;
+   u_longlong_t time;
+   char adapter[IDENTIFIER_LENGTH];
+   unsigned int paths_count;
+   u_longlong_t q_full;
+   u_longlong_t rserv;
+   u_longlong_t rtimeout;
+   u_longlong_t rfailed;
+   u_longlong_t min_rserv;
+   u_longlong_t max_rserv;
+   u_longlong_t wserv;
+   u_longlong_t wtimeout;
+   u_longlong_t wfailed;
+   u_longlong_t min_wserv;
+   u_longlong_t max_wserv;
+   u_longlong_t wq_depth;
+   u_longlong_t wq_sampled;
+   u_longlong_t wq_time;
+   u_longlong_t wq_min_time;
+   u_longlong_t wq_max_time;
+   u_longlong_t q_sampled;
+   u_longlong_t version;         /* after AIX 5.3, not used by the module */
+} perfstat_disk_t;
+
+typedef struct {
+   char name[IDENTIFIER_LENGTH];
+} perfstat_cpu_t;
+
+
+int perfstat_disk( perfstat_id_t *name, perfstat_disk_t *userbuff, int sizeof_struct, int desired_number );
+int perfstat_cpu( perfstat_id_t *name, perfstat_cpu_t *userbuff, int sizeof_struct, int desired_number );
+
+#endif
@@ -0,0 +1,15 @@
+/* Stand-in for the AIX <sys/systemcfg.h> of the aixdisk tests, the tests
+   change the tick conversion factor through it */
+
+#ifndef FAKE_SYS_SYSTEMCFG_H
+#define FAKE_SYS_SYSTEMCFG_H
+
+
+struct sysconf {
+   unsigned int Xint;
+   unsigned int Xfrac;
+};
+
+extern struct sysconf _system_configuration;
+
+#endif
@@ -0,0 +1,24 @@
+/* Stand-in for the AIX <sys/var.h> of the aixdisk tests */
+
+#ifndef FAKE_SYS_VAR_H
+#define FAKE_SYS_VAR_H
+
+
+#define SYSP_GET 1
+#define SYSP_SET 2
+
+#define SYSP_V_IOSTRUN 3
+
+
+struct vario {
+   union {
+      struct {
+         int value;
+      } v_iostrun;
+   } v;
+};
+
+
+int sys_parm( int cmd, int parmflag, struct vario *parmp );
+
+#endif
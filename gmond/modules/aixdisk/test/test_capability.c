@@ -0,0 +1,130 @@
+/* The level of the statistics is taken from what libperfstat accepts at
+   init, trying the structure sizes from the largest down: a provider which
+   only takes the fields up to q_full gets the basic metrics only, one
+   which takes the AIX 5.3 structure or the full one the extended ones as
+   well.  The group rollups follow the level. */
+
+#include "../mod_aixdisk.c"
+#include "aixdisk_test.h"
+
+#include <sys/wait.h>
+
+
+static int
+basic_level( void )
+{
+   fake_max_size = offsetof( perfstat_disk_t, q_full );
+   test_param( "group_all", "hdisk*" );
+   test_init( 2 );
+
+   TEST_CHECK( ! disk_extended );
+   TEST_CHECK( disk_stat_size == offsetof( perfstat_disk_t, q_full ) );
+   TEST_CHECK( active_counters == NUM_BASIC_COUNTERS );
+
+   TEST_CHECK( test_metric( "hdisk0_xfers" ) >= 0 );
+   TEST_CHECK( test_metric( "hdisk0_xrate" ) >= 0 );
+   TEST_CHECK( test_metric( "hdisk0_q_full" ) < 0 );
+   TEST_CHECK( test_metric( "hdisk0_rserv" ) < 0 );
+   TEST_CHECK( test_metric( "hdisk0_wq_sampled" ) < 0 );
+   TEST_CHECK( test_metric( "hdisk0_avg_serv" ) < 0 );
+   TEST_CHECK( test_metric( "hdisk0_busy" ) < 0 );
+   TEST_CHECK( test_metric( "hdisk0_saturation" ) < 0 );
+   TEST_CHECK( test_metric( "aixdisk_saturation_max" ) < 0 );
+   TEST_CHECK( test_metric( "aixdisk_all_xfers" ) >= 0 );
+   TEST_CHECK( test_metric( "aixdisk_all_avg_serv" ) < 0 );
+   TEST_CHECK( group_add == group_add_basic );
+
+   test_cycle( 15 );
+   TEST_NEAR( test_value( "hdisk0_xfers" ), 30.0, 1e-9 );
+   TEST_NEAR( test_value( "hdisk1_xfers" ), 60.0, 1e-9 );
+   TEST_NEAR( test_value( "hdisk0_rbytes" ), 80.0 * 512, 1e-9 );
+   TEST_NEAR( test_value( "hdisk0_wbytes" ), 160.0 * 512, 1e-9 );
+   TEST_NEAR( test_value( "hdisk0_time" ), 50.0, 1e-9 );
+   TEST_NEAR( test_value( "hdisk0_health" ), HEALTH_OK, 0.0 );
+   TEST_NEAR( test_value( "aixdisk_all_xfers" ), 90.0, 1e-9 );
+   TEST_NEAR( test_value( "aixdisk_all_busy" ), 50.0, 1e-9 );
+
+   return( test_done() );
+}
+
+
+
+/* The values of the extended levels, the AIX 5.3 structure or the full
+   one of size */
+static int
+extended( int size )
+{
+   if (size < (int) sizeof( perfstat_disk_t ))
+      fake_max_size = size;
+   test_param( "group_all", "hdisk*" );
+   test_init( 2 );
+
+   TEST_CHECK( disk_extended );
+   TEST_CHECK( disk_stat_size == size );
+   TEST_CHECK( active_counters == NUM_COUNTERS );
+
+   TEST_CHECK( test_metric( "aixdisk_saturation_max" ) >= 0 );
+   TEST_CHECK( test_metric( "aixdisk_all_avg_serv" ) >= 0 );
+   TEST_CHECK( group_add == group_add_extended );
+
+   test_cycle( 15 );
+   TEST_NEAR( test_value( "hdisk0_xfers" ), 30.0, 1e-9 );
+   TEST_NEAR( test_value( "hdisk0_rps" ), 10.0, 1e-9 );
+   TEST_NEAR( test_value( "hdisk0_wps" ), 20.0, 1e-9 );
+   TEST_NEAR( test_value( "hdisk0_busy" ), 50.0, 1e-9 );
+   TEST_NEAR( test_value( "hdisk0_q_full" ), 15.0, 1e-9 );
+   TEST_NEAR( test_value( "hdisk0_avg_serv" ), 15 * 5e6 * 1e-6 / (15 * 30), 1e-12 );
+   TEST_NEAR( test_value( "hdisk1_avg_serv" ), 15 * 10e6 * 1e-6 / (15 * 60), 1e-12 );
+   TEST_NEAR( test_value( "hdisk0_saturation" ), 0.4 * 50 + 0.3 * 100 * 0.001 / 1.001, 1e-9 );
+   TEST_NEAR( test_value( "aixdisk_all_xfers" ), 90.0, 1e-9 );
+   TEST_NEAR( test_value( "aixdisk_all_avg_serv" ), 15 * 15e6 * 1e-6 / (15 * 90), 1e-12 );
+
+   return( test_done() );
+}
+
+
+
+static int
+aix53_level( void )
+{
+   return( extended( DISK_SIZE_AIX53 ) );
+}
+
+
+
+static int
+extended_level( void )
+{
+   return( extended( sizeof( perfstat_disk_t ) ) );
+}
+
+
+
+int
+main( void )
+{
+   int (*level[])( void ) = { basic_level, aix53_level, extended_level };
+   const char *what[] = { "basic", "AIX 5.3", "extended" };
+   pid_t pid;
+   int status,
+       failed = 0,
+       l;
+
+
+/* the module is initialized once per process */
+   for (l = 0;  l < 3;  l++)
+   {
+      pid = fork();
+      if (pid == 0)
+         _exit( level[l]() );
+
+      if ((pid < 0) || (waitpid( pid, &status, 0 ) != pid)
+          || ! WIFEXITED( status ) || (WEXITSTATUS( status ) != 0))
+      {
+         fprintf( stderr, "%s statistics failed\n", what[l] );
+         failed = 1;
+      }
+   }
+
+   return( failed );
+}
@@ -0,0 +1,61 @@
+/* The fill rate follows a disk which fills up at a steady rate and falls
+   back towards zero once its free space stays flat, and the time to full
+   is taken from the current free space at that rate every cycle */
+
+#include "../mod_aixdisk.c"
+#include "aixdisk_test.h"
+
+
+#define MEGABYTE (1024.0 * 1024.0)
+
+
+
+int
+main( void )
+{
+   double rate,
+          last_rate,
+          ttf,
+          last_ttf;
+   int c;
+
+
+   test_param( "fill_window", "600" );
+   test_init( 2 );
+
+/* hdisk0 loses 10 MB a minute, after the two points of the init at the
+   old free space */
+   for (c = 0;  c < 10;  c++)
+   {
+      fake_disk[0].free -= 10;
+      test_cycle( 60 );
+   }
+
+   rate = test_value( "hdisk0_fill_rate" );
+   ttf = test_value( "hdisk0_time_to_full" );
+   TEST_NEAR( rate, 600.0 * MEGABYTE, 1e-3 * 600.0 * MEGABYTE );
+   TEST_NEAR( ttf, 400.0 / 600.0, 1e-3 );
+
+   TEST_NEAR( test_value( "hdisk1_fill_rate" ), 0.0, 0.0 );
+   TEST_NEAR( test_value( "hdisk1_time_to_full" ), -1.0, 0.0 );
+
+
+/* then it stays at 400 MB, the rate falls and the time to full grows */
+   for (c = 0;  c < 60;  c++)
+   {
+      last_rate = rate;
+      last_ttf = ttf;
+
+      test_cycle( 60 );
+
+      rate = test_value( "hdisk0_fill_rate" );
+      ttf = test_value( "hdisk0_time_to_full" );
+      TEST_CHECK( rate < last_rate );
+      TEST_CHECK( (ttf > last_ttf) || (ttf == -1.0) );
+      TEST_CHECK( (rate <= 0.0) || (fabs( ttf - 400.0 * MEGABYTE / rate ) <= 1e-9 * ttf) );
+   }
+
+   TEST_CHECK( fabs( rate ) < 0.01 * 600.0 * MEGABYTE );
+
+   return( test_done() );
+}
@@ -0,0 +1,167 @@
+/* Memory of the metric registration against the number of disks.  Only
+   the name of a metric is allocated per disk, units, slope, format,
+   description and metadata are shared, so the shared part has to stay
+   the same from 1 to 2048 disks.  Prints the footprint per disk count,
+   the metrics_info entries with their names and shared strings, next to
+   what copies of the strings per entry would take. */
+
+#include "../mod_aixdisk.c"
+#include "aixdisk_test.h"
+
+#include <sys/wait.h>
+
+
+#define MAX_SHARED 256
+
+
+struct footprint_t {
+   int disks;
+   int entries;
+   int metrics;                 /* per disk */
+   int interned;
+   int shared;
+   size_t shared_bytes;         /* the shared strings once */
+   size_t name_bytes;           /* the names of all entries */
+   size_t unshared_bytes;       /* what copies per entry would take */
+};
+
+typedef struct footprint_t footprint_t;
+
+
+static const char *shared[MAX_SHARED];
+static int shared_count = 0;
+
+
+static void
+add_shared( const char *s, footprint_t *fp )
+{
+   int j;
+
+
+   for (j = 0;  j < shared_count;  j++)
+      if (shared[j] == s)
+         return;
+
+   TEST_CHECK( shared_count < MAX_SHARED );
+   if (shared_count == MAX_SHARED)
+      return;
+
+   shared[shared_count++] = s;
+   fp->shared_bytes += strlen( s ) + 1;
+}
+
+
+
+static int
+measure( int disks, footprint_t *fp )
+{
+   Ganglia_25metric *gmi,
+                    *first;
+   unsigned int k,
+                i;
+   int e;
+
+
+   test_init( disks );
+   TEST_CHECK( aixdisk_count == disks );
+
+   memset( fp, 0, sizeof( *fp ) );
+   fp->disks = disks;
+   fp->interned = apr_hash_count( interned_strings );
+
+   gmi = aixdisk_module.metrics_info;
+
+   for (e = 0;  gmi[e].name != NULL;  e++)
+   {
+      add_shared( gmi[e].units, fp );
+      add_shared( gmi[e].slope, fp );
+      add_shared( gmi[e].fmt, fp );
+      add_shared( gmi[e].desc, fp );
+
+      fp->name_bytes += strlen( gmi[e].name ) + 1;
+      fp->unshared_bytes += strlen( gmi[e].units ) + strlen( gmi[e].slope ) + strlen( gmi[e].fmt )
+                            + strlen( gmi[e].desc ) + 4;
+
+      TEST_CHECK( gmi[e].metadata == gmi[0].metadata );
+   }
+
+   fp->entries = e;
+   fp->metrics = aixdisk_metric_count;
+   fp->shared = shared_count;
+
+/* every disk's entry of a metric points at the strings of hdisk0's */
+   for (k = 0;  k < aixdisk_metric_count;  k++)
+   {
+      first = &gmi[k * aixdisk_count];
+
+      for (i = 1;  i < aixdisk_count;  i++)
+         if ((gmi[k * aixdisk_count + i].units != first->units)
+             || (gmi[k * aixdisk_count + i].slope != first->slope)
+             || (gmi[k * aixdisk_count + i].fmt != first->fmt)
+             || (gmi[k * aixdisk_count + i].desc != first->desc))
+         {
+            TEST_CHECK( ! "strings shared between the disks" );
+            break;
+         }
+   }
+
+   return( test_done() );
+}
+
+
+
+int
+main( void )
+{
+   const int disks[] = { 1, 16, 256, 2048 };
+   footprint_t fp[4];
+   int fd[2],
+       status,
+       n;
+   pid_t pid;
+
+
+   printf( "%6s %8s %8s %8s %12s %12s %14s %14s\n", "disks", "entries", "interned", "shared",
+           "shared B", "names B", "B per disk", "copies B" );
+
+/* the module is initialized once per process */
+   for (n = 0;  n < 4;  n++)
+   {
+      TEST_CHECK( pipe( fd ) == 0 );
+
+      pid = fork();
+      if (pid == 0)
+      {
+         status = measure( disks[n], &fp[n] );
+         if (write( fd[1], &fp[n], sizeof( fp[n] ) ) != sizeof( fp[n] ))
+            status = 1;
+         _exit( status );
+      }
+
+      close( fd[1] );
+      TEST_CHECK( read( fd[0], &fp[n], sizeof( fp[n] ) ) == sizeof( fp[n] ) );
+      close( fd[0] );
+
+      TEST_CHECK( (pid > 0) && (waitpid( pid, &status, 0 ) == pid) );
+      TEST_CHECK( WIFEXITED( status ) && (WEXITSTATUS( status ) == 0) );
+
+      printf( "%6d %8d %8d %8d %12lu %12lu %14.1f %14lu\n", fp[n].disks, fp[n].entries,
+              fp[n].interned, fp[n].shared, (unsigned long) fp[n].shared_bytes,
+              (unsigned long) fp[n].name_bytes,
+              (double) (fp[n].entries * sizeof( Ganglia_25metric ) + fp[n].shared_bytes
+                        + fp[n].name_bytes) / fp[n].disks,
+              (unsigned long) fp[n].unshared_bytes );
+   }
+
+/* the shared part does not grow with the disks */
+   for (n = 1;  n < 4;  n++)
+   {
+      TEST_CHECK( fp[n].interned == fp[0].interned );
+      TEST_CHECK( fp[n].shared == fp[0].shared );
+      TEST_CHECK( fp[n].shared_bytes == fp[0].shared_bytes );
+      TEST_CHECK( fp[n].metrics == fp[0].metrics );
+      TEST_CHECK( fp[n].entries - fp[0].entries == fp[0].metrics * (disks[n] - disks[0]) );
+   }
+
+   return( test_report() );
+}
@@ -0,0 +1,177 @@
+/* The OpenMetrics endpoint serves the values of the last gmond cycle and
+   never collects by itself */
+
+#include "../mod_aixdisk.c"
+#include "aixdisk_test.h"
+
+
+/* a port nobody listens on right now */
+static int
+free_port( void )
+{
+   struct sockaddr_in sa;
+   socklen_t len = sizeof( sa );
+   int fd,
+       port = -1;
+
+
+   fd = socket( AF_INET, SOCK_STREAM, 0 );
+   memset( &sa, 0, sizeof( sa ) );
+   sa.sin_family = AF_INET;
+   sa.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+   if ((bind( fd, (struct sockaddr *) &sa, sizeof( sa ) ) == 0)
+       && (getsockname( fd, (struct sockaddr *) &sa, &len ) == 0))
+      port = ntohs( sa.sin_port );
+
+   close( fd );
+
+   return( port );
+}
+
+
+
+/* Send the request and read the whole answer into buf */
+static int
+scrape( int port, const char *request, char *buf, size_t size )
+{
+   struct sockaddr_in sa;
+   size_t len = 0;
+   ssize_t n;
+   int fd;
+
+
+   fd = socket( AF_INET, SOCK_STREAM, 0 );
+   memset( &sa, 0, sizeof( sa ) );
+   sa.sin_family = AF_INET;
+   sa.sin_port = htons( port );
+   sa.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+   if ((connect( fd, (struct sockaddr *) &sa, sizeof( sa ) ) != 0)
+       || (write( fd, request, strlen( request ) ) != (ssize_t) strlen( request )))
+   {
+      close( fd );
+      return( -1 );
+   }
+
+   while ((len < size - 1) && ((n = read( fd, buf + len, size - 1 - len )) > 0))
+      len += n;
+
+   buf[len] = '\0';
+   close( fd );
+
+   return( (int) len );
+}
+
+
+
+/* Index of the named metric in aixdisk_metric_data */
+static unsigned int
+metric_index( const char *name )
+{
+   unsigned int m;
+
+
+   for (m = 0;  m < aixdisk_metric_count;  m++)
+      if (strcmp( aixdisk_metric_name[m], name ) == 0)
+         break;
+
+   TEST_CHECK( m < aixdisk_metric_count );
+
+   return( m );
+}
+
+
+
+int
+main( void )
+{
+   static char buf[65536];
+   char port[16],
+        line[128];
+   const char *body;
+   long calls;
+   int p;
+
+
+   p = free_port();
+   TEST_CHECK( p > 0 );
+   snprintf( port, sizeof( port ), "%d", p );
+
+   test_param( "http_port", port );
+   test_init( 2 );
+   TEST_CHECK( http_fd >= 0 );
+
+   test_cycle( 15 );
+   calls = fake_calls;
+
+   TEST_CHECK( scrape( p, "GET /metrics HTTP/1.0\r\n\r\n", buf, sizeof( buf ) ) > 0 );
+   TEST_CHECK( strncmp( buf, "HTTP/1.0 200 OK\r\n", 17 ) == 0 );
+   TEST_CHECK( strstr( buf, "Content-Type: " HTTP_CONTENT_TYPE "\r\n" ) != NULL );
+
+   body = strstr( buf, "\r\n\r\n" );
+   TEST_CHECK( body != NULL );
+   if (body == NULL)
+      return( test_done() );
+   body += 4;
+
+   snprintf( line, sizeof( line ), "Content-Length: %lu\r\n", (unsigned long) strlen( body ) );
+   TEST_CHECK( strstr( buf, line ) != NULL );
+
+   TEST_CHECK( strstr( body, "# TYPE aixdisk_xfers gauge\n" ) != NULL );
+   TEST_CHECK( strstr( body, "\naixdisk_xfers{disk=\"hdisk0\"} 30\n" ) != NULL );
+   TEST_CHECK( strstr( body, "\naixdisk_xfers{disk=\"hdisk1\"} 60\n" ) != NULL );
+   TEST_CHECK( strstr( body, "\naixdisk_busy{disk=\"hdisk1\"} 50\n" ) != NULL );
+   TEST_CHECK( strstr( body, "\naixdisk_health{disk=\"hdisk0\"} 0\n" ) != NULL );
+
+   snprintf( line, sizeof( line ), "\naixdisk_snapshot_timestamp_seconds %.3f\n# EOF\n", (double) fake_now );
+   TEST_CHECK( strstr( body, line ) != NULL );
+   TEST_CHECK( strcmp( body + strlen( body ) - 6, "# EOF\n" ) == 0 );
+
+
+/* time passing and more scrapes do not make the endpoint collect */
+   fake_run( 15 );
+   fake_disk[0].xfers += 15 * 60;
+
+   TEST_CHECK( scrape( p, "GET /metrics HTTP/1.0\r\n\r\n", buf, sizeof( buf ) ) > 0 );
+   TEST_CHECK( strstr( buf, "\naixdisk_xfers{disk=\"hdisk0\"} 30\n" ) != NULL );
+   TEST_CHECK( fake_calls == calls );
+
+
+/* the next gmond cycle shows up in the next scrape */
+   test_cycle( 0 );
+   TEST_CHECK( fake_calls == calls + 1 );
+
+   TEST_CHECK( scrape( p, "GET /metrics HTTP/1.0\r\n\r\n", buf, sizeof( buf ) ) > 0 );
+   TEST_CHECK( strstr( buf, "\naixdisk_xfers{disk=\"hdisk0\"} 90\n" ) != NULL );
+   TEST_CHECK( strstr( buf, "\naixdisk_xfers{disk=\"hdisk1\"} 60\n" ) != NULL );
+
+   TEST_CHECK( scrape( p, "POST /metrics HTTP/1.0\r\n\r\n", buf, sizeof( buf ) ) > 0 );
+   TEST_CHECK( strncmp( buf, "HTTP/1.0 405 ", 13 ) == 0 );
+
+
+/* the special values in the OpenMetrics spelling */
+   pthread_mutex_lock( &snapshot_lock );
+   aixdisk_metric_data[metric_index( "xfers" )][0].curr_value = NAN;
+   aixdisk_metric_data[metric_index( "xfers" )][1].curr_value = INFINITY;
+   aixdisk_metric_data[metric_index( "busy" )][1].curr_value = -INFINITY;
+   pthread_mutex_unlock( &snapshot_lock );
+
+   TEST_CHECK( scrape( p, "GET /metrics HTTP/1.0\r\n\r\n", buf, sizeof( buf ) ) > 0 );
+   TEST_CHECK( strstr( buf, "\naixdisk_xfers{disk=\"hdisk0\"} NaN\n" ) != NULL );
+   TEST_CHECK( strstr( buf, "\naixdisk_xfers{disk=\"hdisk1\"} +Inf\n" ) != NULL );
+   TEST_CHECK( strstr( buf, "\naixdisk_busy{disk=\"hdisk1\"} -Inf\n" ) != NULL );
+
+
+/* a buffer too small for the first line grows to the whole text */
+   body = strstr( buf, "\r\n\r\n" ) + 4;
+   free( http_buf );
+   http_buf_size = 8;
+   http_buf = malloc( http_buf_size );
+
+   TEST_CHECK( render_openmetrics() == strlen( body ) );
+   TEST_CHECK( http_buf_size > strlen( body ) );
+   TEST_CHECK( memcmp( http_buf, body, strlen( body ) ) == 0 );
+
+   return( test_done() );
+}
@@ -0,0 +1,295 @@
+/* The columnar delta and rate pass (counter_deltas() and compute_metrics())
+   against a plain per disk scalar computation of the same values, which
+   have to match bit for bit over random counter moves, resets and idle
+   disks.
+
+   test_kernel -b [disks [rounds]] benchmarks both instead, by default at
+   10000 disks.  bench_kernel_novec is built from this file without
+   vectorization, its columnar time against that of test_kernel -b is the
+   gain of the vectorized loops. */
+
+#include "../mod_aixdisk.c"
+#include "aixdisk_test.h"
+
+
+#define DISKS 10000
+#define ROUNDS 20
+#define BENCH_ROUNDS 200
+
+
+static unsigned long long rnd_state = 88172645463325252ULL;
+
+static unsigned long long
+rnd( void )
+{
+   rnd_state ^= rnd_state << 13;
+   rnd_state ^= rnd_state >> 7;
+   rnd_state ^= rnd_state << 17;
+
+   return( rnd_state );
+}
+
+
+
+/* state of the scalar computation */
+static u_longlong_t *ref_last[NUM_COUNTERS];
+static double *ref_value[MAX_DISK_METRICS];
+static char *ref_idle;
+
+
+/* Deltas and values of disk i computed one by one from ctr_total, the
+   way read_disk() did before the columnar pass */
+static void
+scalar_disk( unsigned int i )
+{
+   const aixdisk_metric_def_t *def;
+   double delta[NUM_COUNTERS],
+          dt,
+          f,
+          v;
+   unsigned int c,
+                k;
+   int moved,
+       ok;
+
+
+   moved = FALSE;
+
+   for (c = 0;  c < active_counters;  c++)
+   {
+      if (ctr_total[c][i] != ref_last[c][i])
+         moved = TRUE;
+
+      delta[c] = (double) (long long) (ctr_total[c][i] - ref_last[c][i]);
+      if (delta[c] < 0.0)
+         delta[c] = -1.0;
+
+      ref_last[c][i] = ctr_total[c][i];
+   }
+
+/* nothing moved in this and the last interval, the values stay */
+   if (ref_idle[i] && ! moved)
+      return;
+
+   ref_idle[i] = ! moved;
+
+   dt = disk_delta_t[i];
+
+   for (k = 0;  k < aixdisk_metric_count;  k++)
+   {
+      def = &aixdisk_metric_defs[aixdisk_metric_id[k]];
+      f = metric_factor[aixdisk_metric_id[k]];
+
+      switch (def->kind)
+      {
+         case KIND_RATE:
+            ok = delta[def->counter] >= 0.0;
+            if (def->scale_by == SCALE_BSIZE)
+               v = delta[def->counter] / dt * f * metric_values[M_BSIZE][i].curr_value;
+            else
+               v = delta[def->counter] / dt * f;
+            break;
+
+         case KIND_DELTA:
+            ok = delta[def->counter] >= 0.0;
+            v = delta[def->counter] * f;
+            break;
+
+         case KIND_RATIO:
+            ok = (delta[def->counter] >= 0.0) && (delta[def->per] >= 0.0);
+            if (def->scale_by == SCALE_BSIZE)
+               v = delta[def->counter] * f * metric_values[M_BSIZE][i].curr_value / NONZERO( delta[def->per] );
+            else
+               v = delta[def->counter] * f / NONZERO( delta[def->per] );
+            break;
+
+         default:
+            continue;
+      }
+
+      if (ok)
+         ref_value[k][i] = v;
+   }
+}
+
+
+
+/* Move the counters of every disk: idle, a reset of one counter or
+   random increments from small to large */
+static void
+move_counters( void )
+{
+   unsigned int c,
+                i;
+   unsigned long long r;
+
+
+   for (i = 0;  i < aixdisk_count;  i++)
+   {
+      r = rnd() % 8;
+      if (r < 2)
+         continue;
+
+      for (c = 0;  c < active_counters;  c++)
+         ctr_total[c][i] += rnd() >> (16 + rnd() % 48);
+
+      if (r == 2)
+         ctr_total[rnd() % active_counters][i] -= 1 + rnd() % 1000;
+   }
+}
+
+
+
+/* one cycle of the columnar pass, the counters and times are in place */
+static void
+columnar_cycle( void )
+{
+   compute_deltas();
+   compute_metrics( aixdisk_count );
+}
+
+
+
+static void
+scalar_cycle( void )
+{
+   unsigned int i;
+
+
+   for (i = 0;  i < aixdisk_count;  i++)
+      scalar_disk( i );
+}
+
+
+
+static void
+setup_scalar( void )
+{
+   unsigned int c,
+                k;
+
+
+   for (c = 0;  c < NUM_COUNTERS;  c++)
+   {
+      ref_last[c] = malloc( sizeof( u_longlong_t ) * aixdisk_count );
+      memcpy( ref_last[c], ctr_last_total[c], sizeof( u_longlong_t ) * aixdisk_count );
+   }
+
+   for (k = 0;  k < aixdisk_metric_count;  k++)
+      ref_value[k] = malloc( sizeof( double ) * aixdisk_count );
+
+   ref_idle = malloc( aixdisk_count );
+   memcpy( ref_idle, disk_idle, aixdisk_count );
+}
+
+
+
+static void
+copy_values( void )
+{
+   unsigned int k,
+                i;
+
+
+   for (k = 0;  k < aixdisk_metric_count;  k++)
+      for (i = 0;  i < aixdisk_count;  i++)
+         ref_value[k][i] = aixdisk_metric_data[k][i].curr_value;
+}
+
+
+
+static double
+seconds( const struct timespec *a, const struct timespec *b )
+{
+   return( (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9 );
+}
+
+
+
+static int
+bench( int rounds )
+{
+   struct timespec a,
+                   b;
+   double columnar = 0.0,
+          scalar = 0.0;
+   int r;
+
+
+   for (r = 0;  r < rounds;  r++)
+   {
+      move_counters();
+      clock_gettime( CLOCK_MONOTONIC, &a );
+      scalar_cycle();
+      clock_gettime( CLOCK_MONOTONIC, &b );
+      scalar += seconds( &a, &b );
+
+      clock_gettime( CLOCK_MONOTONIC, &a );
+      columnar_cycle();
+      clock_gettime( CLOCK_MONOTONIC, &b );
+      columnar += seconds( &a, &b );
+   }
+
+   printf( "%u disks, %u metrics, %d rounds\n", aixdisk_count, aixdisk_metric_count, rounds );
+   printf( "scalar    %10.1f ns/disk\n", scalar / rounds / aixdisk_count * 1e9 );
+   printf( "columnar  %10.1f ns/disk  (%.2fx)\n", columnar / rounds / aixdisk_count * 1e9,
+           scalar / ((columnar > 0.0) ? columnar : 1e-9) );
+
+   return( test_done() );
+}
+
+
+
+int
+main( int argc, char *argv[] )
+{
+   int benchmark = (argc > 1) && (strcmp( argv[1], "-b" ) == 0),
+       disks = (argc > 2) ? atoi( argv[2] ) : DISKS,
+       rounds = (argc > 3) ? atoi( argv[3] ) : BENCH_ROUNDS,
+       mismatches = 0,
+       r;
+   unsigned int k,
+                i;
+
+
+   test_init( disks );
+   TEST_CHECK( aixdisk_count == disks );
+
+/* start from one regular cycle and continue on the same counters */
+   test_cycle( 15 );
+   setup_scalar();
+   copy_values();
+
+   if (benchmark)
+      return( bench( rounds ) );
+
+   for (r = 0;  r < ROUNDS;  r++)
+   {
+      move_counters();
+
+      scalar_cycle();
+      columnar_cycle();
+
+      for (k = 0;  k < aixdisk_metric_count;  k++)
+      {
+         if (! KIND_FROM_DELTAS( aixdisk_metric_defs[aixdisk_metric_id[k]].kind )
+             || (aixdisk_metric_defs[aixdisk_metric_id[k]].kind == KIND_DERIVED))
+            continue;
+
+         for (i = 0;  i < aixdisk_count;  i++)
+            if (memcmp( &ref_value[k][i], &aixdisk_metric_data[k][i].curr_value, sizeof( double ) ) != 0)
+            {
+               if (mismatches++ < 10)
+                  fprintf( stderr, "round %d hdisk%u_%s: columnar %.17g, scalar %.17g\n", r, i,
+                           aixdisk_metric_name[k], aixdisk_metric_data[k][i].curr_value, ref_value[k][i] );
+            }
+      }
+
+/* a mismatch must not carry over into the next round */
+      copy_values();
+   }
+
+   TEST_CHECK( mismatches == 0 );
+
+   return( test_done() );
+}
@@ -0,0 +1,159 @@
+/* The peak sampler reads the enabled disks with name bounded ranges, so a
+   disk added in the middle of the list does not push a known disk out of
+   the sample, and in incremental mode only the disks published next
+   cycle.  The sampler thread waits an hour here, the test takes its
+   samples itself. */
+
+#include "../mod_aixdisk.c"
+#include "aixdisk_test.h"
+
+#include <sys/wait.h>
+
+
+/* Take one sample, returns the number of records */
+static int
+sample( void )
+{
+   int count;
+
+
+   select_peak_disks();
+   count = fetch_peaks();
+
+   pthread_mutex_lock( &peak_lock );
+   sample_peaks( count, get_current_time() );
+   pthread_mutex_unlock( &peak_lock );
+
+   return( count );
+}
+
+
+
+/* Whether the last sample holds the disk */
+static int
+sampled( int count, const char *name )
+{
+   int i;
+
+
+   for (i = 0;  i < count;  i++)
+      if (strcmp( STAT_RECORD( peak_stats, i )->name, name ) == 0)
+         return( TRUE );
+
+   return( FALSE );
+}
+
+
+
+static int
+full( void )
+{
+   char name[MAX_G_STRING_SIZE];
+   int count,
+       i;
+
+
+   test_param( "peak_interval", "3600" );
+   test_param( "disable_after", "1" );
+   test_init( 6 );
+   TEST_CHECK( peak_running );
+
+   test_cycle( 15 );
+   count = sample();
+   TEST_CHECK( count == 6 );
+
+/* hdisk3 is disabled, then hdisk0a shows up between hdisk0 and hdisk1 */
+   fake_gone[3] = 1;
+   test_cycle( 15 );
+   TEST_CHECK( ! aixdisks[3].enabled );
+
+   fake_insert( 1, "hdisk0a" );
+   fake_run( 1 );
+
+   count = sample();
+   TEST_CHECK( count == 6 );
+   TEST_CHECK( sampled( count, "hdisk0a" ) );
+   TEST_CHECK( ! sampled( count, "hdisk3" ) );
+
+   for (i = 0;  i < 6;  i++)
+   {
+      snprintf( name, sizeof( name ), "hdisk%d", i );
+      TEST_CHECK( (i == 3) || sampled( count, name ) );
+      TEST_CHECK( (i == 3) || (peak_time[i] == get_current_time()) );
+   }
+
+/* the sampler waiting for its next sample stops with the module */
+   aixdisk_module.cleanup();
+   TEST_CHECK( threads_running == 0 );
+
+   return( test_report() );
+}
+
+
+
+static int
+incremental( void )
+{
+   int count,
+       i;
+
+
+   test_param( "peak_interval", "3600" );
+   test_param( "collect_budget", "2" );
+   test_param( "hot_disks", "1" );
+   test_init( 8 );
+
+   test_cycle( 15 );
+   test_cycle( 15 );
+
+/* the next slice and the hot disk, the busiest one */
+   count = sample();
+   TEST_CHECK( count == 3 );
+   TEST_CHECK( hot_disk_used == 1 );
+   TEST_CHECK( sampled( count, aixdisks[rotate_next].devName ) );
+   TEST_CHECK( sampled( count, aixdisks[(rotate_next + 1) % aixdisk_count].devName ) );
+   TEST_CHECK( sampled( count, aixdisks[hot_disks[0]].devName ) );
+
+   for (i = 0;  i < aixdisk_count;  i++)
+      TEST_CHECK( peak_want[i] == ((i == hot_disks[0])
+                                   || (i == rotate_next)
+                                   || (i == (rotate_next + 1) % aixdisk_count)) );
+
+   return( test_done() );
+}
+
+
+
+int
+main( void )
+{
+   struct {
+      const char *what;
+      int (*scenario)( void );
+   } run[] = {
+      { "sampling all disks", full },
+      { "sampling in incremental mode", incremental }
+   };
+   pid_t pid;
+   int status,
+       failed = 0,
+       r;
+
+
+/* the module is initialized once per process */
+   for (r = 0;  r < (int) (sizeof( run ) / sizeof( run[0] ));  r++)
+   {
+      pid = fork();
+      if (pid == 0)
+         _exit( run[r].scenario() );
+
+      if ((pid < 0) || (waitpid( pid, &status, 0 ) != pid)
+          || ! WIFEXITED( status ) || (WEXITSTATUS( status ) != 0))
+      {
+         fprintf( stderr, "%s failed\n", run[r].what );
+         failed = 1;
+      }
+   }
+
+   return( failed );
+}
@@ -0,0 +1,67 @@
+/* A change of the tick conversion (Xint/Xfrac) or of the CPU count, as by
+   Live Partition Mobility or DLPAR, flags the interval, keeps the values
+   of the previous one instead of rates over jumped counters, and the next
+   interval uses the new factors */
+
+#include "../mod_aixdisk.c"
+#include "aixdisk_test.h"
+
+
+int
+main( void )
+{
+   int i;
+
+
+   test_init( 2 );
+
+   test_cycle( 15 );
+   TEST_NEAR( test_value( "aixdisk_reconfigured" ), 0.0, 0.0 );
+   TEST_NEAR( test_value( "hdisk0_xfers" ), 30.0, 1e-9 );
+   TEST_NEAR( test_value( "hdisk0_avg_serv" ), 5e6 * 1e-6 / 30, 1e-12 );
+   TEST_NEAR( test_value( "hdisk0_wq_sampled" ), 200 * 0.01 / 4, 1e-12 );
+   TEST_NEAR( serv_baseline[0], 5e6 * 1e-6 / 30, 1e-12 );
+
+
+/* the partition moves: ticks are twice as long, twice the CPUs, and the
+   counters jumped */
+   _system_configuration.Xint = 2;
+   fake_ncpus = 8;
+   for (i = 0;  i < 2;  i++)
+   {
+      fake_disk[i].xfers += 1000000000ULL;
+      fake_disk[i].rserv += 1000000000000ULL;
+   }
+
+   test_cycle( 15 );
+   TEST_NEAR( test_value( "aixdisk_reconfigured" ), 1.0, 0.0 );
+   TEST_NEAR( test_value( "hdisk0_xfers" ), 30.0, 1e-9 );
+   TEST_NEAR( test_value( "hdisk1_xfers" ), 60.0, 1e-9 );
+   TEST_NEAR( test_value( "hdisk0_avg_serv" ), 5e6 * 1e-6 / 30, 1e-12 );
+   TEST_NEAR( test_value( "hdisk0_wq_sampled" ), 200 * 0.01 / 4, 1e-12 );
+   TEST_NEAR( serv_baseline[0], 0.0, 0.0 );
+
+/* the next interval is computed from the new baselines and factors */
+   test_cycle( 15 );
+   TEST_NEAR( test_value( "aixdisk_reconfigured" ), 0.0, 0.0 );
+   TEST_NEAR( test_value( "hdisk0_xfers" ), 30.0, 1e-9 );
+   TEST_NEAR( test_value( "hdisk1_xfers" ), 60.0, 1e-9 );
+   TEST_NEAR( test_value( "hdisk0_avg_serv" ), 5e6 * 2e-6 / 30, 1e-12 );
+   TEST_NEAR( test_value( "hdisk0_wq_sampled" ), 200 * 0.01 / 8, 1e-12 );
+   TEST_NEAR( serv_baseline[0], 5e6 * 2e-6 / 30, 1e-12 );
+
+
+/* a CPU change alone is an event as well */
+   fake_ncpus = 2;
+
+   test_cycle( 15 );
+   TEST_NEAR( test_value( "aixdisk_reconfigured" ), 1.0, 0.0 );
+   TEST_NEAR( test_value( "hdisk0_wq_sampled" ), 200 * 0.01 / 8, 1e-12 );
+
+   test_cycle( 15 );
+   TEST_NEAR( test_value( "aixdisk_reconfigured" ), 0.0, 0.0 );
+   TEST_NEAR( test_value( "hdisk0_wq_sampled" ), 200 * 0.01 / 2, 1e-12 );
+   TEST_NEAR( test_value( "hdisk0_avg_serv" ), 5e6 * 2e-6 / 30, 1e-12 );
+
+   return( test_done() );
+}
@@ -0,0 +1,106 @@
+/* Saturation score on synthetic counter sequences:
+
+      0.4 * busy + 0.3 * 100 * q / (1 + q) + 0.3 * 100 * inflation
+
+   with q the time averaged wait queue size and the inflation of the
+   average service time s over its baseline b, (s / b - 1) / 2 clamped to
+   0 .. 1.  b starts at the first s and follows s with weight 0.05 in
+   intervals below 50 percent busy. */
+
+#include "../mod_aixdisk.c"
+#include "aixdisk_test.h"
+
+
+#define INTERVAL 15
+
+
+/* Move the counters of disk d by one interval of busy percent, q waiting
+   transfers on average and 100 transfers per second at s ms each */
+static void
+interval( int d, double busy, double q, double s )
+{
+   perfstat_disk_t *p = &fake_disk[d];
+   u_longlong_t xfers = INTERVAL * 100;
+
+
+   p->time += (u_longlong_t) (INTERVAL * busy);
+   p->xfers += xfers;
+   p->xrate += xfers / 2;
+
+/* service and wait queue times are in ticks, 1e-6 ms with Xint = Xfrac */
+   p->rserv += (u_longlong_t) (s * 1e6 * xfers / 2);
+   p->wserv += (u_longlong_t) (s * 1e6 * xfers / 2);
+   p->wq_time += (u_longlong_t) (q * INTERVAL * 1e9);
+   p->wq_sampled += (u_longlong_t) (q * INTERVAL * 100);
+}
+
+
+
+static double
+score( double busy, double q, double inflation )
+{
+   return( 0.4 * busy + 0.3 * 100.0 * q / (1.0 + q) + 0.3 * 100.0 * inflation );
+}
+
+
+
+int
+main( void )
+{
+   test_init( 2 );
+
+/* the first busy interval sets the baseline of 2 ms */
+   interval( 0, 30.0, 0.0, 2.0 );
+   fake_now += INTERVAL;
+   test_collect();
+   TEST_NEAR( test_value( "hdisk0_busy" ), 30.0, 1e-9 );
+   TEST_NEAR( test_value( "hdisk0_avg_wqsz" ), 0.0, 1e-9 );
+   TEST_NEAR( test_value( "hdisk0_avg_serv" ), 2.0, 1e-9 );
+   TEST_NEAR( test_value( "hdisk0_saturation" ), score( 30.0, 0.0, 0.0 ), 1e-9 );
+   TEST_NEAR( serv_baseline[0], 2.0, 1e-12 );
+   TEST_NEAR( test_value( "hdisk1_saturation" ), 0.0, 0.0 );
+
+/* queueing at the baseline service time */
+   interval( 0, 80.0, 1.0, 2.0 );
+   fake_now += INTERVAL;
+   test_collect();
+   TEST_NEAR( test_value( "hdisk0_avg_wqsz" ), 1.0, 1e-9 );
+   TEST_NEAR( test_value( "hdisk0_saturation" ), score( 80.0, 1.0, 0.0 ), 1e-9 );
+   TEST_NEAR( test_value( "aixdisk_saturation_max" ), score( 80.0, 1.0, 0.0 ), 1e-9 );
+
+/* service time doubled, half the inflation; a busy interval leaves the
+   baseline alone */
+   interval( 0, 90.0, 3.0, 4.0 );
+   fake_now += INTERVAL;
+   test_collect();
+   TEST_NEAR( test_value( "hdisk0_saturation" ), score( 90.0, 3.0, 0.5 ), 1e-9 );
+   TEST_NEAR( serv_baseline[0], 2.0, 1e-12 );
+
+/* busy is capped at 100 and the inflation at 1 */
+   interval( 0, 120.0, 9.0, 8.0 );
+   fake_now += INTERVAL;
+   test_collect();
+   TEST_NEAR( test_value( "hdisk0_busy" ), 100.0, 0.0 );
+   TEST_NEAR( test_value( "hdisk0_saturation" ), score( 100.0, 9.0, 1.0 ), 1e-9 );
+   TEST_NEAR( test_value( "aixdisk_saturation_max" ), score( 100.0, 9.0, 1.0 ), 1e-9 );
+
+/* a quiet interval scores against the old baseline and then moves it;
+   the host value is the maximum over all disks */
+   interval( 0, 20.0, 0.0, 3.0 );
+   interval( 1, 100.0, 0.0, 2.0 );
+   fake_now += INTERVAL;
+   test_collect();
+   TEST_NEAR( test_value( "hdisk0_saturation" ), score( 20.0, 0.0, 0.25 ), 1e-9 );
+   TEST_NEAR( serv_baseline[0], 2.0 + 0.05 * (3.0 - 2.0), 1e-12 );
+   TEST_NEAR( test_value( "hdisk1_saturation" ), score( 100.0, 0.0, 0.0 ), 1e-9 );
+   TEST_NEAR( test_value( "aixdisk_saturation_max" ), score( 100.0, 0.0, 0.0 ), 1e-9 );
+
+/* no transfers, no saturation */
+   fake_now += INTERVAL;
+   test_collect();
+   TEST_NEAR( test_value( "hdisk0_saturation" ), 0.0, 0.0 );
+   TEST_NEAR( test_value( "hdisk1_saturation" ), 0.0, 0.0 );
+   TEST_NEAR( test_value( "aixdisk_saturation_max" ), 0.0, 0.0 );
+
+   return( test_done() );
+}
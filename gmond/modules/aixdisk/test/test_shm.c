@@ -0,0 +1,112 @@
+/* The shared memory ring as seen through the reader library, from this
+   and from another process */
+
+#include "../mod_aixdisk.c"
+#include "aixdisk_test.h"
+
+#include <sys/wait.h>
+
+
+#define NDISKS 3
+#define NSLOTS 4
+
+
+int
+main( void )
+{
+   aixdisk_shm_t *shm;
+   char name[64];
+   double values[NDISKS * MAX_DISK_METRICS],
+          t;
+   const double *peek;
+   unsigned long long seq;
+   int xfers,
+       health,
+       status,
+       d,
+       i;
+   pid_t pid;
+
+
+   snprintf( name, sizeof( name ), "/aixdisk_test_%ld", (long) getpid() );
+   test_param( "shm_name", name );
+   test_param( "shm_slots", "4" );
+   test_init( NDISKS );
+
+   shm = aixdisk_shm_open( name );
+   TEST_CHECK( shm != NULL );
+   if (shm == NULL)
+      return( test_done() );
+
+   TEST_CHECK( aixdisk_shm_ndisks( shm ) == NDISKS );
+   TEST_CHECK( aixdisk_shm_nmetrics( shm ) == aixdisk_metric_count );
+   TEST_CHECK( aixdisk_shm_nslots( shm ) == NSLOTS );
+   TEST_CHECK( strcmp( aixdisk_shm_disk_name( shm, 2 ), "hdisk2" ) == 0 );
+   TEST_CHECK( aixdisk_shm_latest( shm ) == 0 );
+
+   xfers = aixdisk_shm_metric_index( shm, "xfers" );
+   health = aixdisk_shm_metric_index( shm, "health" );
+   TEST_CHECK( (xfers >= 0) && (health >= 0) );
+   TEST_CHECK( aixdisk_shm_metric_index( shm, "no_such_metric" ) < 0 );
+   if ((xfers < 0) || (health < 0))
+      return( test_done() );
+
+
+/* one snapshot per cycle, with the values served to gmond */
+   test_cycle( 15 );
+
+   seq = aixdisk_shm_latest( shm );
+   TEST_CHECK( seq == 1 );
+   TEST_CHECK( aixdisk_shm_read( shm, seq, &t, values ) == 0 );
+   TEST_NEAR( t, (double) fake_now, 0.0 );
+
+   for (d = 0;  d < NDISKS;  d++)
+   {
+      TEST_NEAR( values[xfers * NDISKS + d], 30.0 * (d + 1), 1e-9 );
+      TEST_NEAR( values[health * NDISKS + d], HEALTH_OK, 0.0 );
+   }
+
+   peek = aixdisk_shm_peek( shm, seq, &t );
+   TEST_CHECK( peek != NULL );
+   if (peek != NULL)
+   {
+      TEST_CHECK( memcmp( peek, values, sizeof( double ) * NDISKS * aixdisk_metric_count ) == 0 );
+      TEST_CHECK( aixdisk_shm_valid( shm, seq ) );
+   }
+
+
+/* another process reads the same numbers */
+   pid = fork();
+   if (pid == 0)
+   {
+      aixdisk_shm_t *other;
+      double v[NDISKS * MAX_DISK_METRICS];
+
+
+      other = aixdisk_shm_open( name );
+      _exit( ((other != NULL) && (aixdisk_shm_latest( other ) == seq)
+              && (aixdisk_shm_read( other, seq, &t, v ) == 0)
+              && (memcmp( v, values, sizeof( double ) * NDISKS * aixdisk_metric_count ) == 0)) ? 0 : 1 );
+   }
+
+   TEST_CHECK( pid > 0 );
+   if (pid > 0)
+   {
+      TEST_CHECK( waitpid( pid, &status, 0 ) == pid );
+      TEST_CHECK( WIFEXITED( status ) && (WEXITSTATUS( status ) == 0) );
+   }
+
+
+/* the writer laps a reader which falls NSLOTS snapshots behind */
+   for (i = 0;  i < NSLOTS;  i++)
+      test_cycle( 15 );
+
+   TEST_CHECK( aixdisk_shm_latest( shm ) == seq + NSLOTS );
+   TEST_CHECK( aixdisk_shm_read( shm, seq, &t, values ) < 0 );
+   TEST_CHECK( ! aixdisk_shm_valid( shm, seq ) );
+   TEST_CHECK( aixdisk_shm_read( shm, seq + 1, &t, values ) == 0 );
+
+   aixdisk_shm_close( shm );
+
+   return( test_done() );
+}
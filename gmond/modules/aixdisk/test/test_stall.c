@@ -0,0 +1,99 @@
+/* A hung perfstat call does not hold up the callbacks beyond the
+   collection deadline, they serve the last values flagged as stale, nor
+   the cleanup beyond THREAD_EXIT_WAIT */
+
+#include "../mod_aixdisk.c"
+#include "aixdisk_test.h"
+
+
+static double
+elapsed( const struct timespec *since )
+{
+   struct timespec ts;
+
+
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+
+   return( (ts.tv_sec - since->tv_sec) + (ts.tv_nsec - since->tv_nsec) / 1e9 );
+}
+
+
+
+int
+main( void )
+{
+   struct timespec start;
+   int busy,
+       i;
+
+
+   test_param( "collect_deadline", "0.2" );
+   test_init( 2 );
+   TEST_CHECK( collect_running );
+
+   test_cycle( 15 );
+   TEST_NEAR( test_value( "hdisk0_xfers" ), 30.0, 1e-9 );
+   TEST_NEAR( test_value( "aixdisk_stale" ), 0.0, 0.0 );
+   TEST_NEAR( test_value( "aixdisk_snapshot_age" ), 0.0, 0.0 );
+
+
+/* perfstat hangs for 1.5 seconds, two cycles of callbacks come back
+   within the deadline with the old values */
+   fake_stall_us = 1500000;
+   fake_disk[0].xfers += 15 * 30;
+
+   clock_gettime( CLOCK_MONOTONIC, &start );
+
+   test_cycle( 15 );
+   TEST_NEAR( test_value( "hdisk0_xfers" ), 30.0, 1e-9 );
+   TEST_NEAR( test_value( "hdisk1_xfers" ), 60.0, 1e-9 );
+   TEST_NEAR( test_value( "aixdisk_stale" ), 1.0, 0.0 );
+   TEST_NEAR( test_value( "aixdisk_snapshot_age" ), 15.0, 0.0 );
+
+   test_cycle( 15 );
+   TEST_NEAR( test_value( "hdisk0_xfers" ), 30.0, 1e-9 );
+   TEST_NEAR( test_value( "aixdisk_stale" ), 1.0, 0.0 );
+   TEST_NEAR( test_value( "aixdisk_snapshot_age" ), 30.0, 0.0 );
+
+   TEST_CHECK( elapsed( &start ) < 1.0 );
+
+
+/* once the call returns the next cycle collects again */
+   fake_stall_us = 0;
+
+   for (i = 0;  i < 500;  i++)
+   {
+      pthread_mutex_lock( &collect_lock );
+      busy = collect_busy;
+      pthread_mutex_unlock( &collect_lock );
+
+      if (! busy)
+         break;
+
+      usleep( 10000 );
+   }
+   TEST_CHECK( ! busy );
+
+   test_cycle( 15 );
+   TEST_NEAR( test_value( "aixdisk_stale" ), 0.0, 0.0 );
+   TEST_NEAR( test_value( "aixdisk_snapshot_age" ), 0.0, 0.0 );
+   TEST_NEAR( test_value( "hdisk0_xfers" ), (45.0 * 30 + 15 * 30) / 45.0, 1e-9 );
+   TEST_NEAR( test_value( "hdisk1_xfers" ), 60.0, 1e-9 );
+
+
+/* the cleanup waits for the collector, but not for one stuck in perfstat
+   past THREAD_EXIT_WAIT */
+   fake_stall_us = (unsigned int) (THREAD_EXIT_WAIT * 2000000.0);
+   test_cycle( 15 );
+
+   clock_gettime( CLOCK_MONOTONIC, &start );
+   aixdisk_module.cleanup();
+   TEST_CHECK( elapsed( &start ) >= THREAD_EXIT_WAIT - 0.1 );
+   TEST_CHECK( elapsed( &start ) < THREAD_EXIT_WAIT + 1.0 );
+   TEST_CHECK( threads_running == 1 );
+
+/* it returns later on its own */
+   TEST_CHECK( wait_threads( THREAD_EXIT_WAIT * 2.0 ) == 0 );
+
+   return( test_report() );
+}
@@ -0,0 +1,123 @@
+/* The state file hands the counter baselines of a disk to the next run
+   only for the same disk, a disk of the same name with another size,
+   volume group or description starts over, and only for reads which
+   were at most STATE_MAX_AGE ago on the monotonic clock, so setting the
+   time of day back does not lose them and a read in the future or long
+   ago is not believed.  The file is saved and opened again in this
+   process, the boot time check passes. */
+
+#include "../mod_aixdisk.c"
+#include "aixdisk_test.h"
+
+#include <stddef.h>
+
+
+#define DISKS 3
+
+
+static char path[64];
+
+
+
+/* Save the state and reopen it at the module time now, the disk baselines
+   are cleared before so the restored ones can be told apart.  Returns the
+   number of restored disks. */
+static int
+reopen( double now, int disk, size_t offset, const void *value, size_t size )
+{
+   int fd,
+       i;
+
+
+   close_state();
+
+   if (disk >= 0)
+   {
+      fd = open( path, O_RDWR );
+      TEST_CHECK( fd >= 0 );
+      TEST_CHECK( pwrite( fd, value, size, sizeof( aixdisk_state_header_t )
+                          + disk * sizeof( aixdisk_state_disk_t ) + offset ) == (ssize_t) size );
+      close( fd );
+   }
+
+   for (i = 0;  i < aixdisk_count;  i++)
+      aixdisks[i].last_read = -1.0;
+
+   return( open_state( path, now ) );
+}
+
+
+
+int
+main( void )
+{
+   unsigned int identity;
+   double now,
+          value;
+   int i;
+
+
+   snprintf( path, sizeof( path ), "/tmp/test_state.%d", (int) getpid() );
+   unlink( path );
+
+   test_param( "state_file", path );
+   test_init( DISKS );
+
+   test_cycle( 15 );
+   test_cycle( 15 );
+
+
+/* all disks come back, read about when they were saved */
+   now = get_current_time();
+   TEST_CHECK( reopen( now, -1, 0, NULL, 0 ) == DISKS );
+   for (i = 0;  i < DISKS;  i++)
+      TEST_NEAR( aixdisks[i].last_read, now, 1.0 );
+
+
+/* the time of day is set back an hour before the next run, the reads
+   keep their age */
+   close_state();
+   fake_now -= 3600;
+   now = get_current_time();
+   TEST_CHECK( open_state( path, now ) == DISKS );
+   for (i = 0;  i < DISKS;  i++)
+      TEST_NEAR( aixdisks[i].last_read, now, 1.0 );
+
+/* and during a run, the reads before it count as just done */
+   fake_now -= 3600;
+   now = get_current_time();
+   TEST_CHECK( reopen( now, -1, 0, NULL, 0 ) == DISKS );
+   for (i = 0;  i < DISKS;  i++)
+      TEST_NEAR( aixdisks[i].last_read, now, 1.0 );
+
+
+/* hdisk1 is another disk now */
+   identity = aixdisks[1].identity ^ 1;
+   TEST_CHECK( reopen( now, 1, offsetof( aixdisk_state_disk_t, identity ),
+                       &identity, sizeof( identity ) ) == DISKS - 1 );
+   TEST_CHECK( aixdisks[1].last_read == -1.0 );
+   TEST_CHECK( aixdisks[0].last_read != -1.0 );
+
+/* and the size is part of the identity */
+   fake_disk[1].size++;
+   TEST_CHECK( disk_identity( &fake_disk[1] ) != aixdisks[1].identity );
+   fake_disk[1].size--;
+
+
+/* a read in the future and one too long ago */
+   value = get_monotonic_time() + 100.0;
+   TEST_CHECK( reopen( now, 0, offsetof( aixdisk_state_disk_t, last_read ),
+                       &value, sizeof( value ) ) == DISKS - 1 );
+   TEST_CHECK( aixdisks[0].last_read == -1.0 );
+
+   value = get_monotonic_time() - STATE_MAX_AGE - 10.0;
+   TEST_CHECK( reopen( now, 2, offsetof( aixdisk_state_disk_t, last_read ),
+                       &value, sizeof( value ) ) == DISKS - 1 );
+   TEST_CHECK( aixdisks[2].last_read == -1.0 );
+   TEST_CHECK( aixdisks[1].last_read != -1.0 );
+
+   i = test_done();
+   unlink( path );
+
+   return( i );
+}
@@ -0,0 +1,206 @@
+/* Disks which vanish are reported missing, disabled after disable_after
+   snapshots, retried with a doubling backoff and enabled again once they
+   are back, without disturbing the other disks.  With workers the
+   vanished hdisk1 starts the range of the second worker.  A disk added
+   in the middle of the list does not push a known disk out of the
+   snapshot, nor out of an incremental slice. */
+
+#include "../mod_aixdisk.c"
+#include "aixdisk_test.h"
+
+#include <sys/wait.h>
+
+
+static int
+vanish( const char *workers )
+{
+   double disabled_at;
+
+
+   test_param( "disable_after", "2" );
+   test_param( "retry_backoff", "60" );
+   test_param( "collect_workers", workers );
+   test_param( "group_all", "hdisk*" );
+   test_init( 3 );
+   TEST_CHECK( (collect_workers > 1) == (atoi( workers ) > 1) );
+
+   test_cycle( 15 );
+   TEST_NEAR( test_value( "hdisk1_health" ), HEALTH_OK, 0.0 );
+   TEST_NEAR( test_value( "hdisk1_xfers" ), 60.0, 1e-9 );
+   TEST_NEAR( test_value( "aixdisk_all_xfers" ), 180.0, 1e-9 );
+
+
+/* hdisk1 is gone, it keeps its last values until it is disabled but
+   leaves the group rollups at once */
+   fake_gone[1] = 1;
+
+   test_cycle( 15 );
+   TEST_NEAR( test_value( "hdisk1_health" ), HEALTH_MISSING, 0.0 );
+   TEST_NEAR( test_value( "hdisk1_xfers" ), 60.0, 1e-9 );
+   TEST_NEAR( test_value( "aixdisk_all_xfers" ), 120.0, 1e-9 );
+   TEST_NEAR( test_value( "hdisk0_xfers" ), 30.0, 1e-9 );
+   TEST_NEAR( test_value( "hdisk2_xfers" ), 90.0, 1e-9 );
+
+   test_cycle( 15 );
+   disabled_at = snapshot_time;
+   TEST_NEAR( test_value( "hdisk1_health" ), HEALTH_DISABLED, 0.0 );
+   TEST_NEAR( test_value( "hdisk1_xfers" ), -1.0, 0.0 );
+   TEST_NEAR( test_value( "hdisk1_busy" ), -1.0, 0.0 );
+   TEST_NEAR( test_value( "hdisk2_xfers" ), 90.0, 1e-9 );
+   TEST_CHECK( ! aixdisks[1].enabled );
+   TEST_NEAR( aixdisks[1].retry_at, disabled_at + 60.0, 0.0 );
+
+
+/* back before the retry is due, it stays disabled until then */
+   fake_gone[1] = 0;
+
+   test_cycle( 15 );
+   TEST_NEAR( test_value( "hdisk1_health" ), HEALTH_DISABLED, 0.0 );
+   TEST_NEAR( test_value( "hdisk1_xfers" ), -1.0, 0.0 );
+
+   test_cycle( 15 );
+   test_cycle( 15 );
+   TEST_NEAR( test_value( "hdisk1_health" ), HEALTH_DISABLED, 0.0 );
+
+/* the retry takes it back, with the rate over the whole gap */
+   test_cycle( 15 );
+   TEST_NEAR( snapshot_time, disabled_at + 60.0, 0.0 );
+   TEST_NEAR( test_value( "hdisk1_health" ), HEALTH_OK, 0.0 );
+   TEST_NEAR( test_value( "hdisk1_xfers" ), 60.0, 1e-9 );
+   TEST_CHECK( aixdisks[1].enabled );
+   TEST_CHECK( aixdisks[1].failures == 0 );
+
+   test_cycle( 15 );
+   TEST_NEAR( test_value( "hdisk1_xfers" ), 60.0, 1e-9 );
+   TEST_NEAR( test_value( "hdisk1_busy" ), 50.0, 1e-9 );
+
+
+/* hdisk2 stays away, every failed retry doubles the backoff */
+   fake_gone[2] = 1;
+
+   test_cycle( 15 );
+   test_cycle( 15 );
+   disabled_at = snapshot_time;
+   TEST_NEAR( test_value( "hdisk2_health" ), HEALTH_DISABLED, 0.0 );
+   TEST_NEAR( aixdisks[2].backoff, 60.0, 0.0 );
+
+   test_cycle( 60 );
+   TEST_NEAR( test_value( "hdisk2_health" ), HEALTH_DISABLED, 0.0 );
+   TEST_NEAR( aixdisks[2].backoff, 120.0, 0.0 );
+   TEST_NEAR( aixdisks[2].retry_at, disabled_at + 60.0 + 120.0, 0.0 );
+
+   TEST_NEAR( test_value( "hdisk0_health" ), HEALTH_OK, 0.0 );
+   TEST_NEAR( test_value( "hdisk0_xfers" ), 30.0, 1e-9 );
+
+/* the workers stop with the module */
+   aixdisk_module.cleanup();
+   TEST_CHECK( threads_running == 0 );
+
+   return( test_report() );
+}
+
+
+
+/* hdisk0a shows up between hdisk0 and hdisk1, in the range of the first
+   worker or of the first slice */
+static int
+insert_disk( void )
+{
+   char name[MAX_G_STRING_SIZE];
+   int c,
+       i;
+
+
+   test_init( 6 );
+
+   test_cycle( 15 );
+   test_cycle( 15 );
+   test_cycle( 15 );
+
+   TEST_NEAR( test_value( "aixdisk_added_disks" ), 0.0, 0.0 );
+
+   fake_insert( 1, "hdisk0a" );
+
+   for (c = 0;  c < 3;  c++)
+   {
+      test_cycle( 15 );
+      TEST_NEAR( test_value( "aixdisk_added_disks" ), 1.0, 0.0 );
+
+      for (i = 0;  i < 6;  i++)
+      {
+         snprintf( name, sizeof( name ), "hdisk%d_health", i );
+         TEST_NEAR( test_value( name ), HEALTH_OK, 0.0 );
+         snprintf( name, sizeof( name ), "hdisk%d_xfers", i );
+         TEST_NEAR( test_value( name ), 30.0 * (i + 1), 1e-9 );
+      }
+   }
+
+   for (i = 0;  i < 6;  i++)
+      TEST_CHECK( aixdisks[i].enabled );
+
+   TEST_CHECK( test_metric( "hdisk0a_xfers" ) < 0 );
+
+   return( test_done() );
+}
+
+
+
+static int
+insert( const char *workers )
+{
+   test_param( "disable_after", "2" );
+   test_param( "collect_workers", workers );
+
+   return( insert_disk() );
+}
+
+
+
+static int
+insert_slice( const char *budget )
+{
+   test_param( "disable_after", "1" );
+   test_param( "collect_budget", budget );
+
+   return( insert_disk() );
+}
+
+
+
+int
+main( void )
+{
+   struct {
+      const char *what;
+      int (*scenario)( const char * );
+      const char *arg;
+   } run[] = {
+      { "vanishing disks with collect_workers", vanish, "1" },
+      { "vanishing disks with collect_workers", vanish, "3" },
+      { "inserted disk with collect_workers", insert, "1" },
+      { "inserted disk with collect_workers", insert, "3" },
+      { "inserted disk with collect_budget", insert_slice, "2" }
+   };
+   pid_t pid;
+   int status,
+       failed = 0,
+       r;
+
+
+/* the module is initialized once per process */
+   for (r = 0;  r < (int) (sizeof( run ) / sizeof( run[0] ));  r++)
+   {
+      pid = fork();
+      if (pid == 0)
+         _exit( run[r].scenario( run[r].arg ) );
+
+      if ((pid < 0) || (waitpid( pid, &status, 0 ) != pid)
+          || ! WIFEXITED( status ) || (WEXITSTATUS( status ) != 0))
+      {
+         fprintf( stderr, "%s %s failed\n", run[r].what, run[r].arg );
+         failed = 1;
+      }
+   }
+
+   return( failed );
+}